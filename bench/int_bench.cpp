@@ -0,0 +1,110 @@
+// Copyright [2017-2024] Orpheus
+
+// Parses and formats the numbers of a typical announce and its response with
+// the stream based functions misc_functions used to have and with the current
+// ones. Build with -DBUILD_BENCHMARKS=ON and run ./int_bench
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+#include "../src/misc_functions.h"
+
+static std::atomic<uint64_t> allocations(0);
+
+void * operator new(size_t size) {
+    allocations++;
+    void * p = malloc(size == 0 ? 1 : size);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void * p) noexcept {
+    free(p);
+}
+
+void operator delete(void * p, size_t) noexcept {
+    free(p);
+}
+
+// left, uploaded, downloaded, corrupt, port and numwant of an announce
+static const std::string_view query_values[] = { "734003200", "1048576", "0", "0", "51413", "200" };
+// complete, downloaded, incomplete, interval, min interval and the length of peers
+static const int64_t response_values[] = { 1542, 28731, 87, 1843, 1800, 300 };
+
+static int64_t old_strtoint64(const std::string &str) {
+    std::istringstream stream(str);
+    int64_t i = 0;
+    stream >> i;
+    return i;
+}
+
+static std::string old_inttostr(int i) {
+    std::stringstream out;
+    out << i;
+    return out.str();
+}
+
+static size_t parse_streams() {
+    size_t sink = 0;
+    for (std::string_view value : query_values) {
+        sink += old_strtoint64(std::string(value));
+    }
+    return sink;
+}
+
+static size_t parse_direct() {
+    size_t sink = 0;
+    for (std::string_view value : query_values) {
+        sink += strtoint64(value);
+    }
+    return sink;
+}
+
+static size_t format_streams() {
+    std::string output;
+    output.reserve(64);
+    for (int64_t value : response_values) {
+        output += old_inttostr(value);
+    }
+    return output.size();
+}
+
+static size_t format_direct() {
+    std::string output;
+    output.reserve(64);
+    for (int64_t value : response_values) {
+        append_int(output, value);
+    }
+    return output.size();
+}
+
+template <typename F>
+static void run(const char * name, F f, unsigned int iterations) {
+    size_t sink = 0;
+    uint64_t before = allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < iterations; i++) {
+        sink += f();
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+    double allocs = static_cast<double>(allocations - before) / iterations;
+    printf("%-16s %8.1f ns/announce %8.2f allocations/announce (%zu)\n", name, ns, allocs, sink);
+}
+
+int main(int argc, char ** argv) {
+    unsigned int iterations = argc > 1 ? atoi(argv[1]) : 1000000;
+    run("parse streams", parse_streams, iterations);
+    run("parse direct", parse_direct, iterations);
+    run("format streams", format_streams, iterations);
+    run("format direct", format_direct, iterations);
+    return 0;
+}
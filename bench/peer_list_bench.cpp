@@ -0,0 +1,139 @@
+// Copyright [2017-2024] Orpheus
+
+// Fills the swarms of a set of torrents with random peers and reports how much
+// memory each peer takes, how long finding a peer by its key takes and how
+// long going through whole swarms takes, for the dense peer list the tracker
+// uses and the std::map it used before. Most swarms are small and a few are
+// big, like on the tracker. Each list is built in a child process of its own
+// so that the resident sizes don't mix.
+// Build with -DBUILD_BENCHMARKS=ON and run ./peer_list_bench [peers]
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "../src/ocelot.h"
+
+#define LOOKUPS 5000000
+
+typedef std::map<peer_key_t, peer> tree_list;
+
+static size_t resident_bytes() {
+    long pages = 0, resident = 0;
+    FILE * f = fopen("/proc/self/statm", "r");
+    if (f != NULL) {
+        if (fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(f);
+    }
+    return static_cast<size_t>(resident) * sysconf(_SC_PAGESIZE);
+}
+
+static void add(tree_list &list, const peer_key_t &key, const peer &p) {
+    list.insert(std::make_pair(key, p));
+}
+
+static void add(peer_list &list, const peer_key_t &key, const peer &p) {
+    list.insert(key, p);
+}
+
+static const peer * lookup(const tree_list &list, const peer_key_t &key) {
+    auto it = list.find(key);
+    return it == list.end() ? NULL : &it->second;
+}
+
+static const peer * lookup(const peer_list &list, const peer_key_t &key) {
+    size_t slot = list.find(key);
+    return slot == peer_list::npos ? NULL : &list.at(slot);
+}
+
+template <typename Entry>
+static const peer & value_of(const Entry &entry) {
+    return entry.second;
+}
+
+template <typename List>
+static void run(const char * name, size_t peer_count) {
+    // Swarm sizes fall off like 1/n, up to a few thousand peers
+    std::mt19937_64 rng(1);
+    std::vector<size_t> swarm_sizes;
+    for (size_t total = 0; total < peer_count; ) {
+        size_t size = std::min<size_t>(peer_count - total, 1 + 4000 / (1 + rng() % 4000));
+        swarm_sizes.push_back(size);
+        total += size;
+    }
+    std::vector<std::vector<peer_key_t>> keys(swarm_sizes.size());
+    for (size_t t = 0; t < swarm_sizes.size(); t++) {
+        keys[t].resize(swarm_sizes[t]);
+        for (peer_key_t &key : keys[t]) {
+            for (size_t i = 0; i < key.size(); i += 8) {
+                uint64_t r = rng();
+                memcpy(key.data() + i, &r, std::min<size_t>(8, key.size() - i));
+            }
+        }
+    }
+    user_ptr u;
+    peer p = {};
+    p.user = u;
+    p.visible = true;
+
+    size_t before = resident_bytes();
+    std::vector<List> lists(swarm_sizes.size());
+    for (size_t t = 0; t < lists.size(); t++) {
+        for (const peer_key_t &key : keys[t]) {
+            p.port = static_cast<uint16_t>(rng());
+            add(lists[t], key, p);
+        }
+    }
+    size_t after = resident_bytes();
+
+    std::mt19937 pick(2);
+    uint64_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < LOOKUPS; i++) {
+        size_t t = pick() % lists.size();
+        sink += lookup(lists[t], keys[t][pick() % keys[t].size()])->port;
+    }
+    auto middle = std::chrono::steady_clock::now();
+    for (int round = 0; round < 10; round++) {
+        for (const List &list : lists) {
+            for (const auto &entry : list) {
+                const peer &candidate = value_of(entry);
+                sink += candidate.visible ? candidate.port : 0;
+            }
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double lookup_ns = std::chrono::duration<double, std::nano>(middle - start).count() / LOOKUPS;
+    double scan_ns = std::chrono::duration<double, std::nano>(end - middle).count() / (10.0 * peer_count);
+    printf("%-24s %7.1f ns/lookup %6.2f ns/peer scanned %8.1f MB %6.1f bytes/peer (%lu)\n", name, lookup_ns, scan_ns,
+        (after - before) / 1048576.0, static_cast<double>(after - before) / peer_count, static_cast<unsigned long>(sink));
+}
+
+template <typename List>
+static void run_in_child(const char * name, size_t peer_count) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        run<List>(name, peer_count);
+        fflush(stdout);
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+}
+
+int main(int argc, char ** argv) {
+    size_t peer_count = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000000;
+    printf("%zu peers of %zu bytes, %d random lookups\n", peer_count, sizeof(peer), LOOKUPS);
+    run_in_child<tree_list>("std::map<peer_key_t>", peer_count);
+    run_in_child<peer_list>("dense_map<peer_key_t>", peer_count);
+    return 0;
+}
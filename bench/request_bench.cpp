@@ -0,0 +1,171 @@
+// Copyright [2017-2024] Orpheus
+
+// Parses a typical announce over and over and reports how long a parse takes
+// and how many heap allocations it makes, next to the maps the worker used to
+// fill, and how a request that arrives in small pieces is found and parsed.
+// Build with -DBUILD_BENCHMARKS=ON and run ./request_bench
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <unordered_map>
+
+#include "../src/request.h"
+#include "../src/scan.h"
+
+static std::atomic<uint64_t> allocations(0);
+
+void * operator new(size_t size) {
+    allocations++;
+    void * p = malloc(size == 0 ? 1 : size);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void * p) noexcept {
+    free(p);
+}
+
+void operator delete(void * p, size_t) noexcept {
+    free(p);
+}
+
+static const std::string announce =
+    "GET /0123456789abcdef0123456789abcdef/announce?info_hash=%12%34%56%78%9a%bc%de%f0%12%34%56%78%9a%bc%de%f0%12%34%56%78"
+    "&peer_id=-qB4500-%21%7e%2aabcdefgh&port=51413&uploaded=1048576&downloaded=0&left=734003200&corrupt=0"
+    "&key=6A1F2C3B&event=started&numwant=200&compact=1&no_peer_id=1&supportcrypto=1&redundant=0 HTTP/1.1\r\n"
+    "Host: tracker.example.com\r\n"
+    "User-Agent: qBittorrent/4.5.0\r\n"
+    "Accept-Encoding: gzip\r\n"
+    "Connection: close\r\n\r\n";
+
+// A browser-like client with the headers to match
+static const std::string long_announce = announce.substr(0, announce.size() - 2) +
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8\r\n"
+    "Accept-Language: en-GB,en-US;q=0.9,en;q=0.8,de;q=0.7,fr;q=0.6\r\n"
+    "Cookie: session=" + std::string(600, 'c') + "; theme=dark; consent=yes; _ga=GA1.2.1234567890.1234567890\r\n"
+    "Referer: https://tracker.example.com/torrents.php?id=123456&torrentid=654321\r\n"
+    "Sec-Fetch-Dest: document\r\nSec-Fetch-Mode: navigate\r\nSec-Fetch-Site: same-origin\r\n\r\n";
+
+// The parser worker::work had before request_t, as far as the parameters and headers go
+static size_t parse_maps(const std::string &input) {
+    std::unordered_map<std::string, std::string> params, headers;
+    std::string passkey(input, 5, 32);
+    std::string key, value;
+    size_t pos = input.find('?') + 1;
+    bool parsing_key = true;
+    for (; pos < input.size(); ++pos) {
+        if (input[pos] == '=') {
+            parsing_key = false;
+        } else if (input[pos] == '&' || input[pos] == ' ') {
+            parsing_key = true;
+            params[key] = value;
+            key.clear();
+            value.clear();
+            if (input[pos] == ' ') {
+                break;
+            }
+        } else if (parsing_key) {
+            key.push_back(input[pos]);
+        } else {
+            value.push_back(input[pos]);
+        }
+    }
+    pos = input.find('\n', pos) + 1;
+    parsing_key = true;
+    bool found_data = false;
+    for (; pos < input.size(); ++pos) {
+        if (input[pos] == ':') {
+            parsing_key = false;
+            ++pos;
+        } else if (input[pos] == '\n' || input[pos] == '\r') {
+            parsing_key = true;
+            if (found_data) {
+                found_data = false;
+                std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+                headers[key] = value;
+                key.clear();
+                value.clear();
+            }
+        } else {
+            found_data = true;
+            if (parsing_key) {
+                key.push_back(input[pos]);
+            } else {
+                value.push_back(input[pos]);
+            }
+        }
+    }
+    return params.size() + headers.size() + passkey.size();
+}
+
+static size_t parse_views(const std::string &input) {
+    request_t req;
+    parse_request(input, req);
+    return req.param_count + req.user_agent.size() + req.passkey.size();
+}
+
+// A slow client: the request arrives TRICKLE_SIZE bytes at a time and every
+// read checks whether it is complete. The old way searched the whole buffer
+// for the blank line on every read and parsed it all again at the end
+#define TRICKLE_SIZE 32
+
+static size_t trickle_find(const std::string &input) {
+    std::string buffer;
+    for (size_t pos = 0; pos < input.size(); pos += TRICKLE_SIZE) {
+        buffer.append(input, pos, TRICKLE_SIZE);
+        size_t end = buffer.find("\r\n\r\n");
+        if (end != std::string::npos) {
+            request_t req;
+            parse_request(std::string_view(buffer).substr(0, end + 4), req);
+            return req.param_count + req.user_agent.size();
+        }
+    }
+    return 0;
+}
+
+static size_t trickle_parser(const std::string &input) {
+    std::string buffer;
+    request_parser parser;
+    for (size_t pos = 0; pos < input.size(); pos += TRICKLE_SIZE) {
+        buffer.append(input, pos, TRICKLE_SIZE);
+        if (parser.feed(buffer)) {
+            request_t req;
+            parser.finish(std::string_view(buffer).substr(0, parser.size()), req);
+            return req.param_count + req.user_agent.size();
+        }
+    }
+    return 0;
+}
+
+template <typename F>
+static void run(const char * name, F parse, const std::string &request, unsigned int iterations) {
+    size_t sink = 0;
+    uint64_t before = allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < iterations; i++) {
+        sink += parse(request);
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+    double allocs = static_cast<double>(allocations - before) / iterations;
+    printf("%-12s %8.1f ns/announce %8.2f allocations/announce (%zu)\n", name, ns, allocs, sink);
+}
+
+int main(int argc, char ** argv) {
+    unsigned int iterations = argc > 1 ? atoi(argv[1]) : 1000000;
+    printf("%zu byte announce, %zu byte announce with browser headers, scanning with %s\n", announce.size(), long_announce.size(), scan_implementation());
+    run("maps", parse_maps, announce, iterations);
+    run("views", parse_views, announce, iterations);
+    run("maps long", parse_maps, long_announce, iterations);
+    run("views long", parse_views, long_announce, iterations);
+    run("trickle find", trickle_find, long_announce, iterations / 10);
+    run("trickle feed", trickle_parser, long_announce, iterations / 10);
+    return 0;
+}
@@ -0,0 +1,116 @@
+// Copyright [2017-2024] Orpheus
+
+// Fills a torrent list with random info hashes and reports how long lookups
+// take and how much memory the list uses, for the flat map the tracker uses
+// and the unordered_maps it used before. Each map is built in a child process
+// of its own so that the resident sizes don't mix.
+// Build with -DBUILD_BENCHMARKS=ON and run ./torrent_map_bench [torrents]
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../src/ocelot.h"
+
+#define LOOKUPS 10000000
+
+typedef std::unordered_map<std::string, torrent> string_map;
+typedef std::unordered_map<infohash_t, torrent, infohash_hasher> node_map;
+
+static size_t resident_bytes() {
+    long pages = 0, resident = 0;
+    FILE * f = fopen("/proc/self/statm", "r");
+    if (f != NULL) {
+        if (fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(f);
+    }
+    return static_cast<size_t>(resident) * sysconf(_SC_PAGESIZE);
+}
+
+static std::vector<infohash_t> random_hashes(size_t count, uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    std::vector<infohash_t> hashes(count);
+    for (infohash_t &hash : hashes) {
+        for (size_t i = 0; i < hash.size(); i += 4) {
+            uint32_t r = static_cast<uint32_t>(rng());
+            memcpy(hash.data() + i, &r, 4);
+        }
+    }
+    return hashes;
+}
+
+static std::string key_of(const infohash_t &hash, string_map *) {
+    return std::string(reinterpret_cast<const char *>(hash.data()), hash.size());
+}
+
+static const infohash_t & key_of(const infohash_t &hash, ...) {
+    return hash;
+}
+
+template <typename Map>
+static void run(const char * name, size_t count) {
+    std::vector<infohash_t> hashes = random_hashes(count, 1);
+    std::vector<infohash_t> misses = random_hashes(LOOKUPS / 10, 2);
+    std::vector<uint32_t> order(LOOKUPS);
+    std::mt19937 rng(3);
+    for (uint32_t &i : order) {
+        i = rng() % count;
+    }
+
+    size_t before = resident_bytes();
+    Map map;
+    map.reserve(count);
+    torrent tor = {};
+    for (size_t i = 0; i < count; i++) {
+        tor.id = i;
+        map.insert(std::make_pair(key_of(hashes[i], &map), tor));
+    }
+    size_t after = resident_bytes();
+
+    uint64_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i : order) {
+        sink += map.find(key_of(hashes[i], &map))->second.id;
+    }
+    auto middle = std::chrono::steady_clock::now();
+    for (const infohash_t &hash : misses) {
+        sink += map.find(key_of(hash, &map)) == map.end();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double hit_ns = std::chrono::duration<double, std::nano>(middle - start).count() / order.size();
+    double miss_ns = std::chrono::duration<double, std::nano>(end - middle).count() / misses.size();
+    printf("%-28s %7.1f ns/hit %7.1f ns/miss %8.1f MB %6.1f bytes/torrent (%lu)\n", name, hit_ns, miss_ns,
+        (after - before) / 1048576.0, static_cast<double>(after - before) / count, static_cast<unsigned long>(sink));
+}
+
+template <typename Map>
+static void run_in_child(const char * name, size_t count) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        run<Map>(name, count);
+        fflush(stdout);
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+}
+
+int main(int argc, char ** argv) {
+    size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 3000000;
+    printf("%zu torrents of %zu bytes, %d random lookups\n", count, sizeof(torrent), LOOKUPS);
+    run_in_child<string_map>("unordered_map<string>", count);
+    run_in_child<node_map>("unordered_map<infohash_t>", count);
+    run_in_child<torrent_list>("flat_hash_map<infohash_t>", count);
+    return 0;
+}
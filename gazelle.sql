@@ -154,7 +154,7 @@ CREATE TABLE `xbt_files_users` (
   `peer_id` binary(20) NOT NULL DEFAULT '\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0',
   `fid` int(11) NOT NULL,
   `mtime` int(11) NOT NULL DEFAULT '0',
-  `ip` varchar(15) NOT NULL DEFAULT '',
+  `ip` varchar(45) NOT NULL DEFAULT '',
   PRIMARY KEY (`peer_id`,`fid`,`uid`),
   KEY `remaining_idx` (`remaining`),
   KEY `fid_idx` (`fid`),
@@ -166,7 +166,7 @@ CREATE TABLE `xbt_snatched` (
   `uid` int(11) NOT NULL DEFAULT '0',
   `tstamp` int(11) NOT NULL,
   `fid` int(11) NOT NULL,
-  `IP` varchar(15) NOT NULL,
+  `IP` varchar(45) NOT NULL,
   `seedtime` int(11) NOT NULL DEFAULT '0',
   KEY `fid` (`fid`),
   KEY `tstamp` (`tstamp`),
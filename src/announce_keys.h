@@ -0,0 +1,83 @@
+#ifndef SRC_ANNOUNCE_KEYS_H_
+#define SRC_ANNOUNCE_KEYS_H_
+
+// Copyright [2017-2024] Orpheus
+
+#include <cstdint>
+#include <string_view>
+
+// The query keys of an announce that the tracker reads
+enum announce_key {
+    KEY_UNKNOWN = 0,
+    KEY_INFO_HASH,
+    KEY_PEER_ID,
+    KEY_PORT,
+    KEY_UPLOADED,
+    KEY_DOWNLOADED,
+    KEY_LEFT,
+    KEY_CORRUPT,
+    KEY_EVENT,
+    KEY_NUMWANT,
+    KEY_COMPACT,
+    KEY_IP,
+    KEY_IPV4,
+    ANNOUNCE_KEY_COUNT
+};
+
+constexpr std::string_view announce_key_names[ANNOUNCE_KEY_COUNT] = {
+    "", "info_hash", "peer_id", "port", "uploaded", "downloaded", "left",
+    "corrupt", "event", "numwant", "compact", "ip", "ipv4"
+};
+
+#define ANNOUNCE_KEY_SLOTS 32
+
+// FNV-1a with a seed in place of the offset basis
+constexpr uint32_t announce_key_hash(std::string_view key, uint32_t seed) {
+    uint32_t hash = seed;
+    for (char c : key) {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+    }
+    return hash % ANNOUNCE_KEY_SLOTS;
+}
+
+// The first seed that gives every key a slot of its own, found by the compiler
+constexpr uint32_t find_announce_key_seed() {
+    for (uint32_t seed = 1; seed != 0; seed++) {
+        bool used[ANNOUNCE_KEY_SLOTS] = {};
+        bool perfect = true;
+        for (int key = KEY_UNKNOWN + 1; key < ANNOUNCE_KEY_COUNT && perfect; key++) {
+            uint32_t slot = announce_key_hash(announce_key_names[key], seed);
+            perfect = !used[slot];
+            used[slot] = true;
+        }
+        if (perfect) {
+            return seed;
+        }
+    }
+    return 0;
+}
+
+constexpr uint32_t announce_key_seed = find_announce_key_seed();
+static_assert(announce_key_seed != 0, "no perfect hash for the announce keys");
+
+struct announce_key_table {
+    announce_key slots[ANNOUNCE_KEY_SLOTS];
+};
+
+constexpr announce_key_table make_announce_key_table() {
+    announce_key_table table = {};
+    for (int key = KEY_UNKNOWN + 1; key < ANNOUNCE_KEY_COUNT; key++) {
+        table.slots[announce_key_hash(announce_key_names[key], announce_key_seed)] = static_cast<announce_key>(key);
+    }
+    return table;
+}
+
+constexpr announce_key_table announce_keys = make_announce_key_table();
+
+// One hash and one comparison, keys the tracker doesn't know are KEY_UNKNOWN
+inline announce_key find_announce_key(std::string_view key) {
+    announce_key found = announce_keys.slots[announce_key_hash(key, announce_key_seed)];
+    return announce_key_names[found] == key ? found : KEY_UNKNOWN;
+}
+
+#endif  // SRC_ANNOUNCE_KEYS_H_
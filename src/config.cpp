@@ -61,11 +61,20 @@ config::config() {
 void config::init() {
     // Internal stuff
     add("listen_port", 34000u);
+    add("listen_path", "");  // unix socket, empty to disable
+    add("udp_port", 0u);  // BEP 15 UDP tracker, 0 to disable
+    add("udp_scrape", false);  // UDP scrapes carry no passkey
     add("max_connections", 1024u);
     add("max_middlemen", 20000u);
+    add("accept_budget", 64u);
+    add("max_loop_lag", 500u);  // milliseconds, 0 to disable
+    add("overload_interval", 3600u);  // 0 to close shed connections without a response
     add("max_read_buffer", 4096u);
     add("connection_timeout", 10u);
     add("keepalive_timeout", 0u);
+    add("event_threads", 1u);
+    add("io_backend", "libev");  // libev or io_uring
+    add("proxy_protocol", false);
     add("daemonize", false);
 
     // Tracker requests
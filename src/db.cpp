@@ -90,7 +90,7 @@ void mysql::load_torrents(torrent_list &torrents) {
     mysqlpp::Query query = conn.query("SELECT t.ID, t.info_hash, t.freetorrent, tls.Snatched FROM torrents t INNER JOIN torrents_leech_stats tls ON (tls.TorrentID = t.ID) ORDER BY t.ID");
     try {
         mysqlpp::StoreQueryResult res = query.store();
-        std::unordered_set<std::string> cur_keys;
+        std::unordered_set<infohash_t, infohash_hasher> cur_keys;
         size_t num_rows = res.num_rows();
         std::lock_guard<std::mutex> tl_lock(torrent_list_mutex);
         if (torrents.size() == 0) {
@@ -103,21 +103,20 @@ void mysql::load_torrents(torrent_list &torrents) {
             }
         }
         for (size_t i = 0; i < num_rows; i++) {
-            std::string info_hash;
-            res[i][1].to_string(info_hash);
-            if (info_hash.empty()) {
+            infohash_t info_hash;
+            if (!infohash_from_binary(std::string_view(res[i][1].data(), res[i][1].length()), info_hash)) {
                 continue;
             }
             mysqlpp::sql_enum free_torrent(res[i][2]);
 
             torrent tmp_tor;
-            auto it = torrents.insert(std::pair<std::string, torrent>(info_hash, tmp_tor));
+            auto it = torrents.insert(std::pair<infohash_t, torrent>(info_hash, tmp_tor));
             torrent &tor = (it.first)->second;
             if (it.second) {
                 tor.id = res[i][0];
                 tor.balance = 0;
                 tor.completed = res[i][3];
-                tor.last_selected_seeder = "";
+                tor.next_seeder = 0;
             } else {
                 tor.tokened_users.clear();
                 cur_keys.erase(info_hash);
@@ -159,7 +158,7 @@ void mysql::load_users(user_list &users) {
     try {
         mysqlpp::StoreQueryResult res = query.store();
         size_t num_rows = res.num_rows();
-        std::unordered_set<std::string> cur_keys;
+        std::unordered_set<passkey_t, passkey_hasher> cur_keys;
         std::lock_guard<std::mutex> ul_lock(user_list_mutex);
         if (users.size() == 0) {
             users.reserve(static_cast<unsigned long>(num_rows * 1.05));  // Reserve 5% extra space to prevent rehashing
@@ -171,10 +170,13 @@ void mysql::load_users(user_list &users) {
             }
         }
         for (size_t i = 0; i < num_rows; i++) {
-            std::string passkey(res[i][2]);
+            passkey_t passkey;
+            if (!passkey_from_string(std::string_view(res[i][2].data(), res[i][2].length()), passkey)) {
+                continue;
+            }
             bool protect_ip = res[i][3];
             user_ptr tmp_user = std::make_shared<user>(res[i][0], res[i][1], protect_ip);
-            auto it = users.insert(std::pair<std::string, user_ptr>(passkey, tmp_user));
+            auto it = users.insert(std::pair<passkey_t, user_ptr>(passkey, tmp_user));
             if (!it.second) {
                 user_ptr &u = (it.first)->second;
                 u->set_leechstatus(res[i][1]);
@@ -206,8 +208,10 @@ void mysql::load_tokens(torrent_list &torrents) {
         size_t num_rows = res.num_rows();
         std::lock_guard<std::mutex> tl_lock(torrent_list_mutex);
         for (size_t i = 0; i < num_rows; i++) {
-            std::string info_hash;
-            res[i][1].to_string(info_hash);
+            infohash_t info_hash;
+            if (!infohash_from_binary(std::string_view(res[i][1].data(), res[i][1].length()), info_hash)) {
+                continue;
+            }
             auto it = torrents.find(info_hash);
             if (it != torrents.end()) {
                 torrent &tor = it->second;
@@ -246,21 +250,33 @@ void mysql::load_whitelist(std::vector<std::string> &whitelist) {
     }
 }
 
-void mysql::record_token(const std::string &record) {
+// Append text as a quoted SQL string, escaped the way mysqlpp::quote does it
+void mysql::append_quoted(std::string &out, std::string_view text) {
+    size_t pos = out.size();
+    out.resize(pos + 2 * text.size() + 3);
+    out[pos] = '\'';
+    size_t escaped = conn.driver()->escape_string(&out[pos + 1], text.data(), text.size());
+    out[pos + 1 + escaped] = '\'';
+    out.resize(pos + escaped + 2);
+}
+
+void mysql::record_token(std::string_view record) {
+    std::lock_guard<std::mutex> tb_lock(token_buffer_lock);
     if (!update_token_buffer.empty()) {
         update_token_buffer += ",";
     }
     update_token_buffer += record;
 }
 
-void mysql::record_user(const std::string &record) {
+void mysql::record_user(std::string_view record) {
+    std::lock_guard<std::mutex> ub_lock(user_buffer_lock);
     if (!update_user_buffer.empty()) {
         update_user_buffer += ",";
     }
     update_user_buffer += record;
 }
 
-void mysql::record_torrent(const std::string &record) {
+void mysql::record_torrent(std::string_view record) {
     std::lock_guard<std::mutex> tb_lock(torrent_buffer_lock);
     if (!update_torrent_buffer.empty()) {
         update_torrent_buffer += ",";
@@ -268,32 +284,43 @@ void mysql::record_torrent(const std::string &record) {
     update_torrent_buffer += record;
 }
 
-void mysql::record_peer(const std::string &record, const std::string &ip, const std::string &peer_id, const std::string &useragent) {
+// The records are written straight into the buffers, without a Query to format them
+void mysql::record_peer(std::string_view record, std::string_view ip, std::string_view peer_id, std::string_view useragent) {
+    std::lock_guard<std::mutex> pb_lock(peer_buffer_lock);
     if (!update_heavy_peer_buffer.empty()) {
         update_heavy_peer_buffer += ",";
     }
-    mysqlpp::Query q = conn.query();
-    q << record << mysqlpp::quote << ip << ',' << mysqlpp::quote << peer_id << ',' << mysqlpp::quote << useragent << "," << time(NULL) << ')';
-
-    update_heavy_peer_buffer += q.str();
+    update_heavy_peer_buffer += record;
+    append_quoted(update_heavy_peer_buffer, ip);
+    update_heavy_peer_buffer += ',';
+    append_quoted(update_heavy_peer_buffer, peer_id);
+    update_heavy_peer_buffer += ',';
+    append_quoted(update_heavy_peer_buffer, useragent);
+    update_heavy_peer_buffer += ',';
+    append_int(update_heavy_peer_buffer, time(NULL));
+    update_heavy_peer_buffer += ')';
 }
-void mysql::record_peer(const std::string &record, const std::string &peer_id) {
+void mysql::record_peer(std::string_view record, std::string_view peer_id) {
+    std::lock_guard<std::mutex> pb_lock(peer_buffer_lock);
     if (!update_light_peer_buffer.empty()) {
         update_light_peer_buffer += ",";
     }
-    mysqlpp::Query q = conn.query();
-    q << record << mysqlpp::quote << peer_id << ',' << time(NULL) << ')';
-
-    update_light_peer_buffer += q.str();
+    update_light_peer_buffer += record;
+    append_quoted(update_light_peer_buffer, peer_id);
+    update_light_peer_buffer += ',';
+    append_int(update_light_peer_buffer, time(NULL));
+    update_light_peer_buffer += ')';
 }
 
-void mysql::record_snatch(const std::string &record, const std::string &ip) {
+void mysql::record_snatch(std::string_view record, std::string_view ip) {
+    std::lock_guard<std::mutex> sb_lock(snatch_buffer_lock);
     if (!update_snatch_buffer.empty()) {
         update_snatch_buffer += ",";
     }
-    mysqlpp::Query q = conn.query();
-    q << record << ',' << mysqlpp::quote << ip << ')';
-    update_snatch_buffer += q.str();
+    update_snatch_buffer += record;
+    update_snatch_buffer += ',';
+    append_quoted(update_snatch_buffer, ip);
+    update_snatch_buffer += ')';
 }
 
 bool mysql::all_clear() {
@@ -309,6 +336,7 @@ void mysql::flush() {
 }
 
 void mysql::flush_users() {
+    std::lock_guard<std::mutex> ub_lock(user_buffer_lock);
     if (readonly) {
         update_user_buffer.clear();
         return;
@@ -365,6 +393,7 @@ void mysql::flush_torrents() {
 }
 
 void mysql::flush_snatches() {
+    std::lock_guard<std::mutex> sb_lock(snatch_buffer_lock);
     if (readonly) {
         update_snatch_buffer.clear();
         return;
@@ -389,6 +418,7 @@ void mysql::flush_snatches() {
 }
 
 void mysql::flush_peers() {
+    std::lock_guard<std::mutex> pb_lock(peer_buffer_lock);
     if (readonly) {
         update_light_peer_buffer.clear();
         update_heavy_peer_buffer.clear();
@@ -452,6 +482,7 @@ void mysql::flush_peers() {
 }
 
 void mysql::flush_tokens() {
+    std::lock_guard<std::mutex> tb_lock(token_buffer_lock);
     if (readonly) {
         update_token_buffer.clear();
         return;
@@ -8,6 +8,7 @@
 #include <mysql++/mysql++.h>
 #include <spdlog/spdlog.h>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <queue>
 #include <memory>
@@ -37,11 +38,15 @@ class mysql {
 
     // These locks prevent more than one thread from reading/writing the buffers.
     // These should be held for the minimum time possible.
+    std::mutex user_buffer_lock;
     std::mutex user_queue_lock;
     std::mutex torrent_buffer_lock;
     std::mutex torrent_queue_lock;
+    std::mutex peer_buffer_lock;
     std::mutex peer_queue_lock;
+    std::mutex snatch_buffer_lock;
     std::mutex snatch_queue_lock;
+    std::mutex token_buffer_lock;
     std::mutex token_queue_lock;
 
     std::shared_ptr<spdlog::logger> logger;
@@ -49,6 +54,7 @@ class mysql {
     void load_config(config * conf);
     void load_tokens(torrent_list &torrents);
     mysqlpp::Connection create_connection();
+    void append_quoted(std::string &out, std::string_view text);
 
     void do_flush_users();
     void do_flush_torrents();
@@ -76,21 +82,21 @@ class mysql {
     void load_whitelist(std::vector<std::string> &whitelist);
 
     // (id,uploaded_change,downloaded_change)
-    void record_user(const std::string &record);
+    void record_user(std::string_view record);
 
     // (id,seeders,leechers,snatched_change,balance)
-    void record_torrent(const std::string &record);
+    void record_torrent(std::string_view record);
 
     // (uid,fid,tstamp)
-    void record_snatch(const std::string &record, const std::string &ip);
+    void record_snatch(std::string_view record, std::string_view ip);
 
     // (uid,fid,active,peerid,useragent,ip,uploaded,downloaded,upspeed,downspeed,left,timespent,announces,tstamp)
-    void record_peer(const std::string &record, const std::string &ip, const std::string &peer_id, const std::string &useragent);
+    void record_peer(std::string_view record, std::string_view ip, std::string_view peer_id, std::string_view useragent);
 
     // (fid,peerid,timespent,announces,tstamp)
-    void record_peer(const std::string &record, const std::string &peer_id);
+    void record_peer(std::string_view record, std::string_view peer_id);
 
-    void record_token(const std::string &record);
+    void record_token(std::string_view record);
 
     std::mutex torrent_list_mutex;
     std::mutex user_list_mutex;
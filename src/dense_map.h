@@ -0,0 +1,168 @@
+#ifndef SRC_DENSE_MAP_H_
+#define SRC_DENSE_MAP_H_
+
+// Copyright [2017-2024] Orpheus
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Maps with this many elements or fewer are searched from start to end and have no index
+#define DENSE_MAP_SCAN_LIMIT 8
+
+/*
+A map for the peers of a swarm. The values are stored next to each other in
+one vector, in no particular order, so going through all of them is a linear
+scan over dense memory. Erasing moves the last value into the hole.
+
+The keys are stored with the values, and a small open addressing table of
+slot numbers (linear probing, backward shift deletion) finds the slot of a
+key. Most swarms are tiny, so maps of up to DENSE_MAP_SCAN_LIMIT elements don't
+build the table and compare the keys one by one instead. The vector grows by
+a quarter instead of doubling, which leaves less unused room behind.
+
+Elements are addressed by their slot. Inserting may move the values and
+erasing moves the last one, so slots and references are only good until
+the map is changed.
+*/
+template <typename Key, typename Value, typename Hash>
+class dense_map {
+ public:
+    typedef std::pair<Key, Value> value_type;
+    typedef typename std::vector<value_type>::iterator iterator;
+    typedef typename std::vector<value_type>::const_iterator const_iterator;
+    static constexpr size_t npos = SIZE_MAX;
+
+ private:
+    static constexpr uint32_t NO_SLOT = UINT32_MAX;
+
+    std::vector<value_type> entries;
+    std::vector<uint32_t> index;  // a power of two in size, or empty
+    Hash hasher;
+
+    size_t home(const Key &key) const { return hasher(key) & (index.size() - 1); }
+
+    // The position of key in the index, or of the empty entry where it would go
+    size_t index_position(const Key &key) const {
+        const size_t mask = index.size() - 1;
+        size_t pos = home(key);
+        while (index[pos] != NO_SLOT && !(entries[index[pos]].first == key)) {
+            pos = (pos + 1) & mask;
+        }
+        return pos;
+    }
+
+    static bool index_full(size_t count, size_t index_size) { return count * 4 > index_size * 3; }
+
+    // Keep the index at most 3/4 full, and drop it once the map is small again
+    void resize_index() {
+        const size_t count = entries.size();
+        size_t new_size = index.size();
+        if (count <= DENSE_MAP_SCAN_LIMIT) {
+            new_size = 0;
+        } else if (index_full(count, index.size()) || count * 8 < index.size()) {
+            new_size = 16;
+            while (new_size < count * 2) {
+                new_size *= 2;
+            }
+        }
+        if (new_size == index.size()) {
+            return;
+        }
+        std::vector<uint32_t>(new_size, NO_SLOT).swap(index);
+        for (size_t i = 0; i < count && new_size != 0; i++) {
+            index[index_position(entries[i].first)] = static_cast<uint32_t>(i);
+        }
+    }
+
+    // Take key out of the index, moving later entries back so that no probe sequence has a gap
+    void index_erase(const Key &key) {
+        const size_t mask = index.size() - 1;
+        size_t hole = index_position(key);
+        for (size_t pos = (hole + 1) & mask; index[pos] != NO_SLOT; pos = (pos + 1) & mask) {
+            // The entry can fill the hole if the hole lies between its home and where it is now
+            if (((pos - home(entries[index[pos]].first)) & mask) >= ((pos - hole) & mask)) {
+                index[hole] = index[pos];
+                hole = pos;
+            }
+        }
+        index[hole] = NO_SLOT;
+    }
+
+ public:
+    size_t size() const { return entries.size(); }
+    bool empty() const { return entries.empty(); }
+    // Bytes used by the entries and the index
+    size_t memory_usage() const {
+        return entries.capacity() * sizeof(value_type) + index.capacity() * sizeof(uint32_t);
+    }
+
+    iterator begin() { return entries.begin(); }
+    iterator end() { return entries.end(); }
+    const_iterator begin() const { return entries.begin(); }
+    const_iterator end() const { return entries.end(); }
+
+    Value & at(size_t slot) { return entries[slot].second; }
+    const Value & at(size_t slot) const { return entries[slot].second; }
+    const Key & key(size_t slot) const { return entries[slot].first; }
+
+    // The slot of key, or npos if it isn't in the map
+    size_t find(const Key &key) const {
+        if (index.empty()) {
+            for (size_t i = 0; i < entries.size(); i++) {
+                if (entries[i].first == key) {
+                    return i;
+                }
+            }
+            return npos;
+        }
+        uint32_t slot = index[index_position(key)];
+        return slot == NO_SLOT ? npos : slot;
+    }
+
+    // Like std::map::insert, returns the slot of key and whether it was added
+    std::pair<size_t, bool> insert(const Key &key, const Value &value) {
+        size_t slot = find(key);
+        if (slot != npos) {
+            return std::make_pair(slot, false);
+        }
+        slot = entries.size();
+        if (slot == entries.capacity()) {
+            entries.reserve(slot + slot / 4 + 1);
+        }
+        entries.emplace_back(key, value);
+        if (!index.empty() && !index_full(slot + 1, index.size())) {
+            index[index_position(key)] = static_cast<uint32_t>(slot);
+        } else {
+            resize_index();
+        }
+        return std::make_pair(slot, true);
+    }
+
+    void erase(size_t slot) {
+        const size_t last = entries.size() - 1;
+        if (!index.empty()) {
+            index_erase(entries[slot].first);
+        }
+        if (slot != last) {
+            if (!index.empty()) {
+                index[index_position(entries[last].first)] = static_cast<uint32_t>(slot);
+            }
+            entries[slot] = std::move(entries[last]);
+        }
+        entries.pop_back();
+        resize_index();
+        if (entries.empty()) {
+            std::vector<value_type>().swap(entries);
+        } else if (entries.size() * 4 < entries.capacity() && entries.capacity() > DENSE_MAP_SCAN_LIMIT) {
+            entries.shrink_to_fit();
+        }
+    }
+
+    void clear() {
+        std::vector<value_type>().swap(entries);
+        std::vector<uint32_t>().swap(index);
+    }
+};
+
+#endif  // SRC_DENSE_MAP_H_
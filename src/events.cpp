@@ -2,7 +2,9 @@
 
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
 #include <cerrno>
+#include <random>
 
 #include "ocelot.h"
 #include "config.h"
@@ -10,7 +12,10 @@
 #include "worker.h"
 #include "schedule.h"
 #include "response.h"
+#include "misc_functions.h"
+#include "proxy_protocol.h"
 #include "events.h"
+#include "uring.h"
 
 std::mutex peak_open_mutex;
 
@@ -18,61 +23,247 @@ std::mutex peak_open_mutex;
 
 //---------- Connection mother - spawns middlemen and lets them deal with the connection
 
-connection_mother::connection_mother(config * conf, worker * worker_obj, mysql * db_obj, site_comm * sc_obj, schedule * sched) : work(worker_obj), db(db_obj) {
+connection_mother::connection_mother(config * conf, worker * worker_obj, mysql * db_obj, site_comm * sc_obj, schedule * sched) : unix_socket(-1), work(worker_obj), db(db_obj) {
     logger = spdlog::get("logger");
 
     // Handle config stuff first
     load_config(conf);
+    build_overload_response(conf);
+    if (event_threads == 0) {
+        event_threads = 1;
+    }
+#ifndef HAVE_LIBURING
+    if (use_io_uring) {
+        logger->error("Ocelot was built without io_uring support, using libev");
+        use_io_uring = false;
+    }
+#endif
+
+    // Listen on a unix socket for reverse proxies on the same host, instead of the port if it is 0
+    if (!listen_path.empty()) {
+        unix_socket = create_unix_socket();
+        if (unix_socket == 0) {
+            logger->critical("Failed to create unix socket for Ocelot. Exiting.");
+            exit(1);
+        }
+    } else if (listen_port == 0) {
+        logger->critical("Neither listen_port nor listen_path is set. Exiting.");
+        exit(1);
+    }
 
-    listen_socket = create_listen_socket();
+    // Connection IDs of the UDP tracker are signed with this
+    std::random_device random;
+    for (uint64_t &k : udp_cookie_key) {
+        k = (static_cast<uint64_t>(random()) << 32) | random();
+    }
 
-    // We failed to create the socket, so no point in running Ocelot
-    if (listen_socket == 0) {
-        logger->critical("Failed to create socket for Ocelot. Exiting.");
-        exit(1);
+    for (unsigned int i = 0; i < event_threads; i++) {
+        listener * l = new listener;
+        listeners.emplace_back(l);
+
+        // The first loop is the default loop, which also runs the schedule timer
+        l->loop = (i == 0 || use_io_uring) ? ev_default_loop(0) : ev_loop_new(EVFLAG_AUTO);
+        l->listen_socket = listen_port != 0 ? create_listen_socket() : -1;
+
+        // We failed to create the socket, so no point in running Ocelot
+        if (l->listen_socket == 0) {
+            logger->critical("Failed to create socket for Ocelot. Exiting.");
+            exit(1);
+        }
+        // The io_uring loops accept on their own
+        if (!use_io_uring) {
+            start_listener(l);
+        }
+
+        // The UDP tracker always runs on libev, with io_uring that is the main thread
+        if (udp_port != 0) {
+            int udp_socket = create_udp_socket();
+            if (udp_socket == 0) {
+                logger->critical("Failed to create UDP socket for Ocelot. Exiting.");
+                exit(1);
+            }
+            l->udp.reset(new udp_tracker(udp_socket, l->loop, work, udp_cookie_key, accept_budget));
+        }
     }
 
-    listen_event.set<connection_mother, &connection_mother::handle_connect>(this);
-    listen_event.start(listen_socket, ev::READ);
     // Create libev timer
     schedule_event.set<schedule, &schedule::handle>(sched);
     schedule_event.start(sched->schedule_interval, sched->schedule_interval);  // After interval, every interval
 }
 
+void connection_mother::start_listener(listener * l) {
+    l->listen_event.set(l->loop);
+    l->listen_event.set<connection_mother, &connection_mother::handle_connect>(this);
+    if (l->listen_socket != -1) {
+        l->listen_event.start(l->listen_socket, ev::READ);
+    }
+    l->unix_event.set(l->loop);
+    l->unix_event.set<connection_mother, &connection_mother::handle_connect>(this);
+    if (unix_socket != -1) {
+        l->unix_event.start(unix_socket, ev::READ);
+    }
+
+    // Listen sockets belong to their loop, so replacing one is done from that loop's thread
+    l->reload_event.set(l->loop);
+    l->reload_event.set<connection_mother, &connection_mother::handle_reload>(this);
+    l->reload_event.start();
+
+    // Middleman timeouts only need one libev timer per loop
+    l->context.reset(new loop_context(l->loop, max_read_buffer));
+    l->tick_event.set(l->loop);
+    l->tick_event.set<connection_mother, &connection_mother::handle_tick>(this);
+    l->tick_event.start(1, 1);
+    l->wake_event.set(l->loop);
+    l->wake_event.set<loop_context, &loop_context::handle_wake>(l->context.get());
+    l->wake_event.start();
+}
+
+connection_mother::listener * connection_mother::find_listener(struct ev_loop * loop) {
+    for (auto &l : listeners) {
+        if (l->loop == loop) {
+            return l.get();
+        }
+    }
+    return NULL;
+}
+
 void connection_mother::load_config(config * conf) {
     listen_port = conf->get_uint("listen_port");
+    listen_path = conf->get_str("listen_path");
+    udp_port = conf->get_uint("udp_port");
     max_connections = conf->get_uint("max_connections");
+    event_threads = conf->get_uint("event_threads");
+    use_io_uring = conf->get_str("io_backend") == "io_uring";
     max_middlemen = conf->get_uint("max_middlemen");
+    accept_budget = std::max(1u, conf->get_uint("accept_budget"));
     connection_timeout = conf->get_uint("connection_timeout");
     keepalive_timeout = conf->get_uint("keepalive_timeout");
     max_read_buffer = conf->get_uint("max_read_buffer");
     max_request_size = conf->get_uint("max_request_size");
+    max_loop_lag = conf->get_uint("max_loop_lag");
+    proxy_protocol = conf->get_bool("proxy_protocol");
+}
+
+// Build the response to connections we turn away: a failure with a long interval, so clients
+// back off instead of retrying right away. With an interval of 0 they are just closed.
+void connection_mother::build_overload_response(config * conf) {
+    unsigned int interval = conf->get_uint("overload_interval");
+    std::shared_ptr<std::string> response = std::make_shared<std::string>();
+    if (interval != 0) {
+        client_opts_t client_opts = { false, false, true, false };
+        const std::string message = "The tracker is overloaded, try again later";
+        response_t r = http_response(
+            "d14:failure reason" + inttostr(message.length()) + ':' + message
+                + "8:intervali" + inttostr(interval) + "e12:min intervali" + inttostr(interval) + "ee",
+            client_opts
+        );
+        response->append(r.prefix, r.prefix_size);
+        response->append(r.head, r.head_size);
+        response->append(r.body);
+    }
+    std::atomic_store(&overload_response, std::shared_ptr<const std::string>(response));
 }
 
 void connection_mother::reload_config(config * conf) {
     unsigned int old_listen_port = listen_port;
+    std::string old_listen_path = listen_path;
+    unsigned int old_udp_port = udp_port;
     unsigned int old_max_connections = max_connections;
+    unsigned int old_event_threads = event_threads;
+    bool old_use_io_uring = use_io_uring;
     load_config(conf);
-    if (old_listen_port != listen_port) {
+    build_overload_response(conf);
+    if (old_event_threads != event_threads) {
+        logger->warn("Changing event_threads requires a restart");
+        event_threads = old_event_threads;
+    }
+    if (old_use_io_uring != use_io_uring) {
+        logger->warn("Changing io_backend requires a restart");
+        use_io_uring = old_use_io_uring;
+    }
+    if (old_listen_path != listen_path) {
+        logger->warn("Changing listen_path requires a restart");
+        listen_path = old_listen_path;
+    }
+    if (old_udp_port != udp_port) {
+        logger->warn("Changing udp_port requires a restart");
+        udp_port = old_udp_port;
+    }
+    if (old_listen_port != listen_port && (use_io_uring || old_listen_port == 0 || listen_port == 0)) {
+        logger->warn("Changing listen_port with the io_uring backend or from or to 0 requires a restart");
+        listen_port = old_listen_port;
+    } else if (old_listen_port != listen_port) {
         logger->info("Changing listen port from " + std::to_string(old_listen_port) +" to " + std::to_string(listen_port));
-        int new_listen_socket = create_listen_socket();
-        if (new_listen_socket != 0) {
-            listen_event.stop();
-            listen_event.start(new_listen_socket, ev::READ);
-            close(listen_socket);
-            listen_socket = new_listen_socket;
-        } else {
-            logger->error("Couldn't create new listen socket when reloading config");
+        for (auto &l : listeners) {
+            l->reload_event.send();
         }
     } else if (old_max_connections != max_connections) {
-        listen(listen_socket, max_connections);
+        for (auto &l : listeners) {
+            if (l->listen_socket != -1) {
+                listen(l->listen_socket, max_connections);
+            }
+        }
+        if (unix_socket != -1) {
+            listen(unix_socket, max_connections);
+        }
     }
 }
 
-int connection_mother::create_listen_socket() {
-    sockaddr_in address;
+// Replace the listen socket of the loop that owns this watcher after a port change
+void connection_mother::handle_reload(ev::async &watcher, int events_flags) {
+    listener * l = find_listener(watcher.loop);
+    int new_listen_socket = create_listen_socket();
+    if (new_listen_socket != 0) {
+        l->listen_event.stop();
+        l->listen_event.start(new_listen_socket, ev::READ);
+        close(l->listen_socket);
+        l->listen_socket = new_listen_socket;
+    } else {
+        logger->error("Couldn't create new listen socket when reloading config");
+    }
+}
+
+// Expire the middlemen of this loop whose time is up, and measure how late
+// the tick is, which is how long the loop was busy with other work
+void connection_mother::handle_tick(ev::timer &watcher, int events_flags) {
+    loop_context * context = find_listener(watcher.loop)->context.get();
+    double now = monotonic_time();
+    context->lag = std::max(0.0, now - context->next_tick);
+    context->next_tick = std::max(context->next_tick + 1, now);
+    context->wheel.advance(static_cast<time_t>(now));
+}
+
+// Open an IPv6 socket that takes IPv4 clients as well, or an IPv4 socket on hosts without IPv6,
+// and fill in the wildcard address to bind it to
+int connection_mother::create_dual_stack_socket(int type, unsigned int port, sockaddr_storage &address, socklen_t &address_len) {
     memset(&address, 0, sizeof(address));
-    int new_listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+    int new_socket = socket(AF_INET6, type, 0);
+    if (new_socket != -1) {
+        int no = 0;
+        if (setsockopt(new_socket, IPPROTO_IPV6, IPV6_V6ONLY, &no, sizeof(int)) == -1) {
+            logger->error("Could not accept IPv4 on an IPv6 socket: " + std::string(strerror(errno)));
+        }
+        sockaddr_in6 &address6 = reinterpret_cast<sockaddr_in6 &>(address);
+        address6.sin6_family = AF_INET6;
+        address6.sin6_addr = in6addr_any;
+        address6.sin6_port = htons(port);
+        address_len = sizeof(address6);
+        return new_socket;
+    }
+
+    new_socket = socket(AF_INET, type, 0);
+    sockaddr_in &address4 = reinterpret_cast<sockaddr_in &>(address);
+    address4.sin_family = AF_INET;
+    address4.sin_addr.s_addr = htonl(INADDR_ANY);
+    address4.sin_port = htons(port);
+    address_len = sizeof(address4);
+    return new_socket;
+}
+
+int connection_mother::create_listen_socket() {
+    sockaddr_storage address;
+    socklen_t address_len;
+    int new_listen_socket = create_dual_stack_socket(SOCK_STREAM, listen_port, address, address_len);
 
     // Stop old sockets from hogging the port
     int yes = 1;
@@ -81,13 +272,14 @@ int connection_mother::create_listen_socket() {
         return 0;
     }
 
-    // Get ready to bind
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = htonl(INADDR_ANY);
-    address.sin_port = htons(listen_port);
+    // Let every event loop bind its own socket to the same port
+    if (setsockopt(new_listen_socket, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(int)) == -1) {
+        logger->error("Could not reuse port: " + std::string(strerror(errno)));
+        return 0;
+    }
 
     // Bind
-    if (bind(new_listen_socket, (sockaddr *) &address, sizeof(address)) == -1) {
+    if (bind(new_listen_socket, (sockaddr *) &address, address_len) == -1) {
         logger->error("Bind failed: " + std::string(strerror(errno)));
         return 0;
     }
@@ -112,142 +304,381 @@ int connection_mother::create_listen_socket() {
     return new_listen_socket;
 }
 
+// The unix socket is shared by every loop, they all accept from it
+int connection_mother::create_unix_socket() {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    if (listen_path.size() >= sizeof(address.sun_path)) {
+        logger->error("listen_path is too long");
+        return 0;
+    }
+    int new_unix_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    // Remove the socket file left behind by the last run
+    unlink(listen_path.c_str());
+
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, listen_path.c_str(), listen_path.size());
+    if (bind(new_unix_socket, (sockaddr *) &address, sizeof(address)) == -1) {
+        logger->error("Bind failed: " + std::string(strerror(errno)));
+        return 0;
+    }
+
+    // The proxy usually runs as another user
+    if (chmod(listen_path.c_str(), 0666) == -1) {
+        logger->error("Could not set permissions of " + listen_path + ": " + std::string(strerror(errno)));
+        return 0;
+    }
+
+    if (listen(new_unix_socket, max_connections) == -1) {
+        logger->error("Listen failed: " + std::string(strerror(errno)));
+        return 0;
+    }
+
+    int flags = fcntl(new_unix_socket, F_GETFL);
+    if (flags == -1 || fcntl(new_unix_socket, F_SETFL, flags | O_NONBLOCK) == -1) {
+        logger->error("Could not set non-blocking: " + std::string(strerror(errno)));
+        return 0;
+    }
+
+    return new_unix_socket;
+}
+
+int connection_mother::create_udp_socket() {
+    sockaddr_storage address;
+    socklen_t address_len;
+    int new_udp_socket = create_dual_stack_socket(SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, udp_port, address, address_len);
+
+    // Every event loop gets its own socket, the kernel spreads the clients between them
+    int yes = 1;
+    if (setsockopt(new_udp_socket, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(int)) == -1) {
+        logger->error("Could not reuse UDP port: " + std::string(strerror(errno)));
+        return 0;
+    }
+
+    if (bind(new_udp_socket, (sockaddr *) &address, address_len) == -1) {
+        logger->error("UDP bind failed: " + std::string(strerror(errno)));
+        return 0;
+    }
+
+    return new_udp_socket;
+}
+
 void connection_mother::run() {
-    logger->info("Sockets up on port " + std::to_string(listen_port) + ", starting event loop!");
+    std::string sockets;
+    if (listen_port != 0) {
+        sockets = "port " + std::to_string(listen_port);
+    }
+    if (unix_socket != -1) {
+        sockets += (sockets.empty() ? "" : " and ") + listen_path;
+    }
+    if (udp_port != 0) {
+        sockets += ", UDP port " + std::to_string(udp_port);
+    }
+    logger->info("Sockets up on " + sockets + ", starting " + std::to_string(listeners.size())
+        + (use_io_uring ? " io_uring" : " event") + " loop(s)!");
+
+    // Signals are handled on the main thread only
+    sigset_t all_signals, old_signals;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_BLOCK, &all_signals, &old_signals);
+    if (use_io_uring) {
+#ifdef HAVE_LIBURING
+        for (auto &l : listeners) {
+            uring_loop * u = new uring_loop(l->listen_socket, unix_socket, work, this);
+            std::thread thread(&uring_loop::run, u);
+            thread.detach();
+        }
+#endif
+    } else {
+        for (size_t i = 1; i < listeners.size(); i++) {
+            struct ev_loop * loop = listeners[i]->loop;
+            std::thread thread([loop] { ev_loop(loop, 0); });
+            thread.detach();
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+    // With io_uring the default loop only runs the schedule timer
     ev_loop(ev_default_loop(0), 0);
 }
 
+// Count a new connection. Returns false if we are at max_middlemen or the
+// loop is lag seconds behind, and the connection should be shed instead
+bool connection_mother::open_connection(double lag) {
+    if (stats.open_connections >= max_middlemen || (max_loop_lag != 0 && lag * 1000 > max_loop_lag)) {
+        return false;
+    }
+    stats.opened_connections++;
+    {
+        const std::lock_guard<std::mutex> lock(peak_open_mutex);
+        unsigned int current_open = stats.open_connections++;
+        if (stats.peak_connections < current_open) {
+            stats.peak_connections = current_open;
+        }
+    }
+    return true;
+}
+
+// Answer a connection we have no room for with the back-off response and close it
+void connection_mother::shed_connection(int fd) {
+    stats.shed_connections++;
+    std::shared_ptr<const std::string> response = std::atomic_load(&overload_response);
+    if (!response->empty()) {
+        // Closing a socket with unread data resets the connection, which could
+        // throw away the response before the client reads it
+        char buffer[4096];
+        for (int i = 0; i < 4 && recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT) > 0; i++) {
+        }
+        if (send(fd, response->data(), response->size(), MSG_NOSIGNAL | MSG_DONTWAIT) > 0) {
+            stats.bytes_written += response->size();
+        }
+    }
+    close(fd);
+}
+
 void connection_mother::handle_connect(ev::io &watcher, int events_flags) {
-    // Spawn a new middleman
-    if (stats.open_connections < max_middlemen) {
-        stats.opened_connections++;
-        {
-            const std::lock_guard<std::mutex> lock(peak_open_mutex);
-            unsigned int current_open = stats.open_connections++;
-            if (stats.peak_connections < current_open) {
-                stats.peak_connections = current_open;
+    // How far behind the loop is: the lag measured by the tick, or the time this iteration has taken so far
+    loop_context * context = find_listener(watcher.loop)->context.get();
+    double lag = std::max(context->lag, monotonic_time() - context->woke);
+
+    // Drain the backlog, but give the other watchers on this loop a turn after accept_budget connections.
+    // Connections are accepted even when we are overloaded, leaving them in the backlog would
+    // only wake us up again right away.
+    for (unsigned int i = 0; i < accept_budget; i++) {
+        sockaddr_storage client_addr;
+        socklen_t addr_len = sizeof(client_addr);
+        int connect_sock = accept4(watcher.fd, (sockaddr *) &client_addr, &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (connect_sock == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                logger->error("Accept failed, errno " + std::to_string(errno) + ": " + std::string(strerror(errno)));
             }
+            return;
         }
-        new connection_middleman(listen_socket, work, this);
+
+        if (!open_connection(lag)) {
+            shed_connection(connect_sock);
+            continue;
+        }
+
+        // Put a middleman to work
+        context->pool.get()->start(connect_sock, client_addr, context, work, this);
     }
 }
 
 connection_mother::~connection_mother()
 {
-    close(listen_socket);
+    for (auto &l : listeners) {
+        if (l->listen_socket != -1) {
+            close(l->listen_socket);
+        }
+    }
+    if (unix_socket != -1) {
+        close(unix_socket);
+        unlink(listen_path.c_str());
+    }
 }
 
 
-//---------- Connection middlemen - these little guys live until their connection is closed
+//---------- Loop context - shared by the middlemen of one loop
 
-connection_middleman::connection_middleman(int &listen_socket, worker * new_work, connection_mother * mother_arg) :
-    written(0), mother(mother_arg), work(new_work)
-{
-    auto logger = spdlog::get("logger");
-    connect_sock = accept(listen_socket, NULL, NULL);
-    if (connect_sock == -1) {
-        logger->error("Accept failed, errno " + std::to_string(errno) + ": " + std::string(strerror(errno)));
-        delete this;
-        return;
-    }
+loop_context::loop_context(struct ev_loop * loop_arg, unsigned int buffer_size) :
+    loop(loop_arg), wheel(static_cast<time_t>(monotonic_time())), lag(0), next_tick(monotonic_time() + 1), woke(monotonic_time()), read_buffer(new char[buffer_size]), read_buffer_size(buffer_size) {
+}
 
-    // Set non-blocking
-    int flags = fcntl(connect_sock, F_GETFL);
-    if (flags == -1) {
-        logger->warn("Could not get connect socket flags");
-    }
-    if (fcntl(connect_sock, F_SETFL, flags | O_NONBLOCK) == -1) {
-        logger->warn("Could not set non-blocking");
+connection_middleman * middleman_pool::get() {
+    if (free_middlemen.empty()) {
+        const size_t slab_size = 64;
+        connection_middleman * slab = new connection_middleman[slab_size];
+        slabs.emplace_back(slab);
+        for (size_t i = 0; i < slab_size; i++) {
+            free_middlemen.push_back(&slab[i]);
+        }
     }
+    connection_middleman * m = free_middlemen.back();
+    free_middlemen.pop_back();
+    return m;
+}
+
+void middleman_pool::put(connection_middleman * m) {
+    free_middlemen.push_back(m);
+}
+
+
+//---------- Connection middlemen - these little guys live until their connection is closed
+
+void connection_middleman::start(int sock, const sockaddr_storage &client_addr, loop_context * context_arg, worker * new_work, connection_mother * mother_arg) {
+    connect_sock = sock;
+    close_after = false;
+    parser.reset();
+    context = context_arg;
+    mother = mother_arg;
+    work = new_work;
+    client_opts.proxy_protocol = proxy_header_pending = mother_arg->proxy_protocol;
+
+    // Get their info. Unix socket clients have no address, the proxy has to tell us.
+    ip_from_sockaddr(client_addr, ip);
 
-    // Get their info
-    request.reserve(mother->max_read_buffer);
-    written = 0;
+    // Stay on the loop that accepted us
+    read_event.set(context->loop);
+    write_event.set(context->loop);
 
     read_event.set<connection_middleman, &connection_middleman::handle_read>(this);
     read_event.start(connect_sock, ev::READ);
+    write_event.set<connection_middleman, &connection_middleman::handle_write>(this);
 
     // Let the socket timeout in timeout_interval seconds
-    timeout_event.set<connection_middleman, &connection_middleman::handle_timeout>(this);
-    timeout_event.set(mother->connection_timeout, mother->keepalive_timeout);
-    timeout_event.start();
+    context->wheel.arm(this, mother->connection_timeout);
 }
 
-connection_middleman::~connection_middleman() {
+// Close the connection and hand the middleman back to the pool of its loop
+void connection_middleman::release() {
+    read_event.stop();
+    write_event.stop();
+    disarm();
     close(connect_sock);
     stats.open_connections--;
+    request.clear();
+    request.shrink_to_fit();
+    responses.clear();
+    context->pool.put(this);
 }
 
 // Handler to read data from the socket, called by event loop when socket is readable
 void connection_middleman::handle_read(ev::io &watcher, int events_flags) {
-    char buffer[mother->max_read_buffer + 1];
-    memset(buffer, 0, mother->max_read_buffer + 1);
-    int ret = recv(connect_sock, &buffer, mother->max_read_buffer, 0);
+    int ret = recv(connect_sock, context->read_buffer.get(), context->read_buffer_size, 0);
 
     if (ret <= 0) {
-        delete this;
+        release();
         return;
     }
     stats.bytes_read += ret;
-    request.append(buffer, ret);
-    size_t request_size = request.size();
-    if (request_size > mother->max_request_size || (request_size >= 4 && request.compare(request_size - 4, std::string::npos, "\r\n\r\n") == 0)) {
-        stats.requests++;
-        read_event.stop();
-        client_opts.gzip = false;
-        client_opts.html = false;
-        client_opts.http_close = true;
-
-        if (request_size > mother->max_request_size) {
-            shutdown(connect_sock, SHUT_RD);
-            response = error("GET string too long", client_opts);
-        } else {
-            char ip[INET_ADDRSTRLEN];
-            sockaddr_in client_addr;
-            socklen_t addr_len = sizeof(client_addr);
-            getpeername(connect_sock, (sockaddr *) &client_addr, &addr_len);
-            inet_ntop(AF_INET, &(client_addr.sin_addr), ip, INET_ADDRSTRLEN);
-            std::string ip_str = ip;
-
-            //--- CALL WORKER
-            response = work->work(request, ip_str, client_opts);
-            request.clear();
-            request_size = 0;
-        }
-
-        // Find out when the socket is writeable.
-        // The loop in connection_mother will call handle_write when it is.
-        write_event.set<connection_middleman, &connection_middleman::handle_write>(this);
-        write_event.start(connect_sock, ev::WRITE);
+
+    // Most requests arrive in one read, so only copy the data into our own
+    // buffer if it has to wait for the rest of the request
+    std::string &input = request.empty() ? context->request : request;
+    if (request.empty()) {
+        input.assign(context->read_buffer.get(), ret);
+    } else {
+        input.append(context->read_buffer.get(), ret);
+    }
+
+    size_t pos = 0;
+    if (proxy_header_pending) {
+        size_t header_size;
+        switch (parse_proxy_header(input.data(), input.size(), mother->max_request_size, header_size, ip)) {
+            case PROXY_HEADER_INVALID:
+                release();
+                return;
+            case PROXY_HEADER_INCOMPLETE:
+                if (request.empty()) {
+                    request = context->request;
+                }
+                return;
+            case PROXY_HEADER_DONE:
+                proxy_header_pending = false;
+                pos = header_size;
+                break;
+        }
+    }
+
+    // A read may hold several pipelined requests. Requests have no body, so
+    // each one ends with the first blank line. The parser remembers how far
+    // it got, so only the bytes of this read are scanned
+    while (!close_after) {
+        std::string_view rest = std::string_view(input).substr(pos);
+        if (!parser.feed(rest)) {
+            break;
+        }
+        handle_request(rest.substr(0, parser.size()));
+        pos += parser.size();
+        parser.reset();
+    }
+    if (!close_after && input.size() - pos > mother->max_request_size) {
+        shutdown(connect_sock, SHUT_RD);
+        handle_request(std::string_view(input).substr(pos));
+    }
+
+    // Keep the start of an incomplete request for the next read
+    if (close_after || pos == input.size()) {
+        request.clear();
+    } else if (&input == &request) {
+        request.erase(0, pos);
+    } else {
+        request.assign(input, pos, std::string::npos);
+    }
+
+    if (!responses.empty()) {
+        // Responses are small and usually fit in the socket buffer, so don't wait for the loop
+        write_response();
     }
 }
 
+// Queue the response to one complete request
+void connection_middleman::handle_request(std::string_view input) {
+    stats.requests++;
+    client_opts.gzip = false;
+    client_opts.html = false;
+    client_opts.http_close = true;
+
+    if (input.size() > mother->max_request_size) {
+        responses.push(error("GET string too long", client_opts));
+    } else {
+        // The worker may replace the address with one given by the client
+        ip_address client_ip = ip;
+
+        request_t req;
+        request_status req_status = parser.finish(input, req);
+
+        //--- CALL WORKER
+        responses.push(work->work(req, req_status, client_ip, client_opts));
+    }
+    close_after = client_opts.http_close;
+}
+
 // Handler to write data to the socket, called by event loop when socket is writeable
 void connection_middleman::handle_write(ev::io &watcher, int events_flags) {
-    int ret = send(connect_sock, response.c_str()+written, response.size()-written, MSG_NOSIGNAL);
+    write_response();
+}
+
+// Send as much of the queued responses as the socket takes, and only wait for
+// the socket to become writeable if some of it is left. May release the middleman.
+void connection_middleman::write_response() {
+    // Headers and bodies go out together without being joined into one buffer
+    struct iovec iov[RESPONSE_QUEUE_IOV];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = responses.get_iovec(iov);
+    int ret = sendmsg(connect_sock, &msg, MSG_NOSIGNAL);
     if (ret == -1) {
-        return;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            release();
+            return;
+        }
+        ret = 0;
     }
     stats.bytes_written += ret;
-    written += ret;
-    if (written == response.size()) {
-        write_event.stop();
-        if (client_opts.http_close) {
-            timeout_event.stop();
-            delete this;
-            return;
+    responses.consume(ret);
+    if (!responses.empty()) {
+        // Stop reading until the client catches up, and find out when the socket is writeable.
+        // The loop in connection_mother will call handle_write when it is.
+        read_event.stop();
+        if (!write_event.is_active()) {
+            write_event.start(connect_sock, ev::WRITE);
         }
-        timeout_event.again();
-        read_event.start();
-        response.clear();
-        written = 0;
+        return;
     }
+    write_event.stop();
+    if (close_after) {
+        release();
+        return;
+    }
+    context->wheel.arm(this, mother->keepalive_timeout);
+    read_event.start();
 }
 
 // After a middleman has been alive for timout_interval seconds, this is called
-void connection_middleman::handle_timeout(ev::timer &watcher, int events_flags) {
-    timeout_event.stop();
-    read_event.stop();
-    write_event.stop();
-    delete this;
+void connection_middleman::expire() {
+    release();
 }
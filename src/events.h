@@ -15,22 +15,31 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <spdlog/spdlog.h>
+#include <signal.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 // libev
 #include <ev++.h>
 
+#include <chrono>
 #include <iostream>
 #include <cstring>
 #include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "config.h"
 #include "worker.h"
 #include "schedule.h"
 #include "db.h"
 #include "site_comm.h"
+#include "response.h"
+#include "timer_wheel.h"
+#include "udp.h"
 
 /*
 We have three classes - the mother, the middlemen, and the worker
@@ -38,6 +47,9 @@ THE MOTHER
     The mother is called when a client opens a connection to the server.
     It creates a middleman for every new connection, which will be called
     when its socket is ready for reading.
+    With event_threads > 1 the mother runs one event loop per thread, each
+    with its own SO_REUSEPORT listen socket, and the kernel spreads new
+    connections across them. A middleman lives on the loop that accepted it.
 THE MIDDLEMEN
     Each middleman hang around until data is written to its socket. It then
     reads the data and sends it to the worker. When it gets the response, it
@@ -49,18 +61,78 @@ THE WORKER
     see worker.h for the worker.
 */
 
+class connection_middleman;
+
+// Recycles the middlemen of one loop. They are allocated in slabs and never freed.
+class middleman_pool {
+ private:
+    std::vector<std::unique_ptr<connection_middleman[]>> slabs;
+    std::vector<connection_middleman *> free_middlemen;
+
+ public:
+    connection_middleman * get();
+    void put(connection_middleman * m);
+};
+
+// Seconds on a clock that doesn't jump when the wall clock is set, for
+// measuring how far behind a loop is
+inline double monotonic_time() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// State shared by the middlemen of one event loop
+struct loop_context {
+    struct ev_loop * loop;
+    timer_wheel wheel;
+    middleman_pool pool;
+    double lag;  // seconds the last tick was late
+    double next_tick;  // monotonic_time() the next tick is due at
+    double woke;  // monotonic_time() the loop last woke up at
+    // Every read goes here first, and requests that arrive in one read are
+    // handed to the worker from request without touching the middleman
+    std::unique_ptr<char[]> read_buffer;
+    unsigned int read_buffer_size;
+    std::string request;
+
+    loop_context(struct ev_loop * loop_arg, unsigned int buffer_size);
+    void handle_wake(ev::check &watcher, int events_flags) { woke = monotonic_time(); }
+};
+
 // THE MOTHER - Spawns connection middlemen
 class connection_mother {
  private:
+    // Per-thread event loop, the listen socket it accepts from and the state of its middlemen.
+    // Every loop also watches the shared unix socket, if there is one.
+    struct listener {
+        struct ev_loop * loop;
+        int listen_socket;
+        ev::io listen_event;
+        ev::io unix_event;
+        ev::async reload_event;
+        ev::timer tick_event;
+        ev::check wake_event;
+        std::unique_ptr<loop_context> context;
+        std::unique_ptr<udp_tracker> udp;
+    };
+
     void load_config(config * conf);
+    void build_overload_response(config * conf);
+    void start_listener(listener * l);
+    listener * find_listener(struct ev_loop * loop);
     unsigned int listen_port;
+    std::string listen_path;
+    int unix_socket;
+    unsigned int udp_port;
+    uint64_t udp_cookie_key[2];
     unsigned int max_connections;
+    unsigned int event_threads;
+    bool use_io_uring;
 
-    int listen_socket;
+    std::vector<std::unique_ptr<listener>> listeners;
     worker * work;
     mysql * db;
-    ev::io listen_event;
     ev::timer schedule_event;
+    std::shared_ptr<const std::string> overload_response;
     std::shared_ptr<spdlog::logger> logger;
 
  public:
@@ -68,40 +140,57 @@ class connection_mother {
     ~connection_mother();
     void reload_config(config * conf);
     int create_listen_socket();
+    int create_unix_socket();
+    int create_udp_socket();
+    int create_dual_stack_socket(int type, unsigned int port, sockaddr_storage &address, socklen_t &address_len);
     void run();
+    bool open_connection(double lag);
+    void shed_connection(int fd);
     void handle_connect(ev::io &watcher, int events_flags);
+    void handle_reload(ev::async &watcher, int events_flags);
+    void handle_tick(ev::timer &watcher, int events_flags);
 
     unsigned int max_middlemen;
+    unsigned int accept_budget;
     unsigned int connection_timeout;
     unsigned int keepalive_timeout;
     unsigned int max_read_buffer;
     unsigned int max_request_size;
+    unsigned int max_loop_lag;
+    bool proxy_protocol;
 };
 
 // THE MIDDLEMAN
-// Created by connection_mother
-// Add their own watchers to see when sockets become readable
-class connection_middleman {
+// Taken from the pool of its loop by connection_mother and returned to it when the connection closes
+// Add their own watchers to see when sockets become readable,
+// and time out through the timer wheel of their loop
+class connection_middleman : public timer_node {
  private:
     int connect_sock;
     client_opts_t client_opts;
-    unsigned int written;
+    bool close_after;  // close once the queued responses are sent
+    bool proxy_header_pending;
     ev::io read_event;
     ev::io write_event;
-    ev::timer timeout_event;
-    std::string request;
-    std::string response;
+    loop_context * context;
+    ip_address ip;
+    std::string request;  // only used for requests that span several reads
+    request_parser parser;  // how far the current request has been read
+    response_queue responses;
 
     connection_mother * mother;
     worker * work;
 
+    void release();
+    void handle_request(std::string_view input);
+    void write_response();
+
  public:
-    connection_middleman(int &listen_socket, worker* work, connection_mother * mother_arg);
-    ~connection_middleman();
+    void start(int sock, const sockaddr_storage &client_addr, loop_context * context_arg, worker* work, connection_mother * mother_arg);
 
     void handle_read(ev::io &watcher, int events_flags);
     void handle_write(ev::io &watcher, int events_flags);
-    void handle_timeout(ev::timer &watcher, int events_flags);
+    void expire();
 };
 
 #endif  // SRC_EVENTS_H_
@@ -0,0 +1,295 @@
+#ifndef SRC_FLAT_MAP_H_
+#define SRC_FLAT_MAP_H_
+
+// Copyright [2017-2024] Orpheus
+
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <utility>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define FLAT_MAP_GROUP_SIZE 16
+
+/*
+An open addressing hash map for the big tables of the tracker, which hold
+millions of entries. Keys and values are stored inline in one array of slots,
+next to an array of control bytes that say for each slot whether it is empty,
+deleted, or holds a key whose hash has these 7 low bits.
+
+The slots come in groups of FLAT_MAP_GROUP_SIZE. The high bits of the hash
+pick the first group to look in. A lookup compares the 7 bits with all control
+bytes of the group at once (with SSE2 where there is SSE2), only looks at the
+keys that match, and goes on to the next group until it finds one with an
+empty slot. Any number of groups works, so reserve() can size the map for
+7/8 of the slots to be used instead of rounding up to a power of two: the
+values are stored inline, and torrents are big enough for that to matter.
+
+Unlike std::unordered_map, inserting may move every element, so references and
+iterators don't survive an insert. Erasing leaves the other elements in place.
+generation() changes whenever the elements move, so that a walk over the map
+that lets go of its lock in between can tell whether it has to start over.
+*/
+template <typename Key, typename Value, typename Hash>
+class flat_hash_map {
+ public:
+    typedef std::pair<Key, Value> value_type;
+
+    template <typename Map, typename Pair>
+    class basic_iterator {
+     private:
+        Map * map;
+        size_t index;
+
+        void skip_free() {
+            while (index < map->capacity && map->ctrl[index] < 0) {
+                index++;
+            }
+        }
+
+     public:
+        basic_iterator(Map * map_arg, size_t index_arg) : map(map_arg), index(index_arg) { skip_free(); }
+        Pair & operator*() const { return map->slots[index]; }
+        Pair * operator->() const { return &map->slots[index]; }
+        basic_iterator & operator++() {
+            index++;
+            skip_free();
+            return *this;
+        }
+        bool operator==(const basic_iterator &other) const { return index == other.index; }
+        bool operator!=(const basic_iterator &other) const { return index != other.index; }
+
+        friend class flat_hash_map;
+    };
+    typedef basic_iterator<flat_hash_map, value_type> iterator;
+    typedef basic_iterator<const flat_hash_map, const value_type> const_iterator;
+
+ private:
+    // Control bytes of slots without a key are negative, the others hold 7 bits of the hash
+    static const int8_t EMPTY = -128;
+    static const int8_t DELETED = -2;
+
+    int8_t * ctrl;
+    value_type * slots;
+    size_t capacity;  // a multiple of the group size, or 0 before the first insert
+    size_t count;
+    size_t growth_left;  // empty slots that may be filled before the map has to grow
+    size_t rehashes;
+    Hash hasher;
+
+    static size_t max_load(size_t slot_count) { return slot_count - slot_count / 8; }
+    static int8_t short_hash(size_t hash) { return static_cast<int8_t>(hash & 0x7F); }
+
+    // Maps the hash onto the groups with a multiplication instead of a modulo
+    size_t first_group(size_t hash) const {
+        return static_cast<size_t>((static_cast<unsigned __int128>(hash) * (capacity / FLAT_MAP_GROUP_SIZE)) >> 64);
+    }
+
+    size_t next_group(size_t group) const {
+        return group + 1 == capacity / FLAT_MAP_GROUP_SIZE ? 0 : group + 1;
+    }
+
+    // Bit i is set if control byte i of the group is c
+    static uint32_t match(const int8_t * group, int8_t c) {
+#ifdef __SSE2__
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(c)));
+#else
+        uint32_t mask = 0;
+        for (unsigned int i = 0; i < FLAT_MAP_GROUP_SIZE; i++) {
+            mask |= static_cast<uint32_t>(group[i] == c) << i;
+        }
+        return mask;
+#endif
+    }
+
+    // Bit i is set if slot i of the group is empty or deleted
+    static uint32_t match_free(const int8_t * group) {
+#ifdef __SSE2__
+        return _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(group)));
+#else
+        uint32_t mask = 0;
+        for (unsigned int i = 0; i < FLAT_MAP_GROUP_SIZE; i++) {
+            mask |= static_cast<uint32_t>(group[i] < 0) << i;
+        }
+        return mask;
+#endif
+    }
+
+    // The slot of key, or capacity if it isn't in the map
+    template <typename LookupKey>
+    size_t find_index(const LookupKey &key) const {
+        if (capacity == 0) {
+            return capacity;
+        }
+        const size_t hash = hasher(key);
+        for (size_t group = first_group(hash); ; group = next_group(group)) {
+            const int8_t * group_ctrl = ctrl + group * FLAT_MAP_GROUP_SIZE;
+            for (uint32_t m = match(group_ctrl, short_hash(hash)); m != 0; m &= m - 1) {
+                size_t i = group * FLAT_MAP_GROUP_SIZE + __builtin_ctz(m);
+                if (slots[i].first == key) {
+                    return i;
+                }
+            }
+            if (match(group_ctrl, EMPTY) != 0) {
+                return capacity;
+            }
+        }
+    }
+
+    // The first empty or deleted slot on the probe sequence of hash
+    size_t find_free(size_t hash) const {
+        for (size_t group = first_group(hash); ; group = next_group(group)) {
+            uint32_t m = match_free(ctrl + group * FLAT_MAP_GROUP_SIZE);
+            if (m != 0) {
+                return group * FLAT_MAP_GROUP_SIZE + __builtin_ctz(m);
+            }
+        }
+    }
+
+    // Claim a slot for a key that isn't in the map yet. The slot is left for the caller to construct
+    size_t prepare_insert(const Key &key) {
+        const size_t hash = hasher(key);
+        if (capacity == 0) {
+            resize(FLAT_MAP_GROUP_SIZE);
+        }
+        size_t i = find_free(hash);
+        if (growth_left == 0 && ctrl[i] == EMPTY) {
+            // Grow if the map is full of keys, otherwise the rehash just clears the deleted slots
+            resize(count * 2 > max_load(capacity) ? capacity * 2 : capacity);
+            i = find_free(hash);
+        }
+        if (ctrl[i] == EMPTY) {
+            growth_left--;
+        }
+        ctrl[i] = short_hash(hash);
+        count++;
+        return i;
+    }
+
+    void resize(size_t new_capacity) {
+        int8_t * old_ctrl = ctrl;
+        value_type * old_slots = slots;
+        size_t old_capacity = capacity;
+
+        ctrl = new int8_t[new_capacity];
+        memset(ctrl, EMPTY, new_capacity);
+        slots = static_cast<value_type *>(::operator new(new_capacity * sizeof(value_type)));
+        capacity = new_capacity;
+        growth_left = max_load(new_capacity) - count;
+        rehashes++;
+
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old_ctrl[i] >= 0) {
+                const size_t hash = hasher(old_slots[i].first);
+                size_t j = find_free(hash);
+                ctrl[j] = short_hash(hash);
+                new (&slots[j]) value_type(std::move(old_slots[i]));
+                old_slots[i].~value_type();
+            }
+        }
+        delete[] old_ctrl;
+        ::operator delete(old_slots);
+    }
+
+ public:
+    flat_hash_map() : ctrl(NULL), slots(NULL), capacity(0), count(0), growth_left(0), rehashes(0) {}
+    flat_hash_map(const flat_hash_map &) = delete;
+    flat_hash_map & operator=(const flat_hash_map &) = delete;
+
+    ~flat_hash_map() {
+        clear();
+        delete[] ctrl;
+        ::operator delete(slots);
+    }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    size_t generation() const { return rehashes; }
+    // Bytes used by the slots and control bytes
+    size_t memory_usage() const { return capacity * (sizeof(value_type) + 1); }
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, capacity); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, capacity); }
+
+    // Lookups take anything the hash and == take along with Key, so that
+    // the caller doesn't have to build a Key first
+    template <typename LookupKey>
+    iterator find(const LookupKey &key) { return iterator(this, find_index(key)); }
+    template <typename LookupKey>
+    const_iterator find(const LookupKey &key) const { return const_iterator(this, find_index(key)); }
+
+    std::pair<iterator, bool> insert(value_type value) {
+        size_t i = find_index(value.first);
+        if (i != capacity) {
+            return std::make_pair(iterator(this, i), false);
+        }
+        i = prepare_insert(value.first);
+        new (&slots[i]) value_type(std::move(value));
+        return std::make_pair(iterator(this, i), true);
+    }
+
+    Value & operator[](const Key &key) {
+        size_t i = find_index(key);
+        if (i == capacity) {
+            i = prepare_insert(key);
+            new (&slots[i]) value_type(key, Value());
+        }
+        return slots[i].second;
+    }
+
+    // Deleted slots in groups that were never full can be empty again,
+    // since no probe sequence ever had to go past them
+    void erase(iterator it) {
+        const size_t i = it.index;
+        slots[i].~value_type();
+        count--;
+        if (match(ctrl + (i & ~static_cast<size_t>(FLAT_MAP_GROUP_SIZE - 1)), EMPTY) != 0) {
+            ctrl[i] = EMPTY;
+            growth_left++;
+        } else {
+            ctrl[i] = DELETED;
+        }
+    }
+
+    template <typename LookupKey>
+    size_t erase(const LookupKey &key) {
+        iterator it = find(key);
+        if (it == end()) {
+            return 0;
+        }
+        erase(it);
+        return 1;
+    }
+
+    // Make room for n elements without growing on the way
+    void reserve(size_t n) {
+        if (n <= max_load(capacity)) {
+            return;
+        }
+        size_t new_capacity = (n + n / 7 + FLAT_MAP_GROUP_SIZE) & ~static_cast<size_t>(FLAT_MAP_GROUP_SIZE - 1);
+        while (max_load(new_capacity) < n) {
+            new_capacity += FLAT_MAP_GROUP_SIZE;
+        }
+        resize(new_capacity);
+    }
+
+    void clear() {
+        for (size_t i = 0; i < capacity; i++) {
+            if (ctrl[i] >= 0) {
+                slots[i].~value_type();
+            }
+        }
+        if (capacity != 0) {
+            memset(ctrl, EMPTY, capacity);
+        }
+        count = 0;
+        growth_left = max_load(capacity);
+    }
+};
+
+#endif  // SRC_FLAT_MAP_H_
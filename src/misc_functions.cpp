@@ -1,35 +1,80 @@
 // Copyright [2017-2024] Orpheus
 
-#include <iostream>
-#include <sstream>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <cstring>
+#include <limits>
 #include <string>
 
 #include "misc_functions.h"
 
-int32_t strtoint32(const std::string& str) {
-    std::istringstream stream(str);
-    int32_t i = 0;
-    stream >> i;
-    return i;
+// Read a decimal number the way istream >> does it in the C locale: skip leading
+// white space, take an optional sign and as many digits as there are, and clamp
+// values out of range. Anything that isn't a number is 0. Nothing is allocated
+template <typename T>
+static T parse_int(std::string_view str) {
+    size_t pos = 0;
+    while (pos < str.size() && (str[pos] == ' ' || (str[pos] >= '\t' && str[pos] <= '\r'))) {
+        pos++;
+    }
+    bool negative = false;
+    if (pos < str.size() && (str[pos] == '-' || str[pos] == '+')) {
+        negative = str[pos] == '-';
+        pos++;
+    }
+    const uint64_t limit = negative ? static_cast<uint64_t>(std::numeric_limits<T>::max()) + 1 : std::numeric_limits<T>::max();
+    uint64_t value = 0;
+    for (; pos < str.size() && str[pos] >= '0' && str[pos] <= '9'; pos++) {
+        unsigned int digit = str[pos] - '0';
+        if (value > (limit - digit) / 10) {
+            return negative ? std::numeric_limits<T>::min() : std::numeric_limits<T>::max();
+        }
+        value = value * 10 + digit;
+    }
+    return negative ? static_cast<T>(0 - value) : static_cast<T>(value);
 }
 
-int64_t strtoint64(const std::string& str) {
-    std::istringstream stream(str);
-    int64_t i = 0;
-    stream >> i;
-    return i;
+int32_t strtoint32(std::string_view str) {
+    return parse_int<int32_t>(str);
 }
 
+int64_t strtoint64(std::string_view str) {
+    return parse_int<int64_t>(str);
+}
 
-std::string inttostr(const int i) {
-    std::string str;
-    std::stringstream out;
-    out << i;
-    str = out.str();
-    return str;
+// Write i in decimal to buf, which has room for INT_BUFFER_SIZE characters.
+// Returns the length, buf is not NUL terminated
+size_t format_int(char * buf, int64_t i) {
+    char digits[INT_BUFFER_SIZE];
+    char * end = digits + INT_BUFFER_SIZE;
+    char * p = end;
+    uint64_t value = i < 0 ? 0 - static_cast<uint64_t>(i) : static_cast<uint64_t>(i);
+    do {
+        *--p = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    if (i < 0) {
+        *--p = '-';
+    }
+    memcpy(buf, p, end - p);
+    return end - p;
 }
 
-std::string hex_decode(const std::string &in) {
+void append_int(std::string &out, int64_t i) {
+    char buf[INT_BUFFER_SIZE];
+    out.append(buf, format_int(buf, i));
+}
+
+std::string inttostr(int64_t i) {
+    char buf[INT_BUFFER_SIZE];
+    return std::string(buf, format_int(buf, i));
+}
+
+std::string hex_decode(std::string_view in) {
     std::string out;
     out.reserve(20);
     unsigned int in_length = in.length();
@@ -61,7 +106,119 @@ std::string hex_decode(const std::string &in) {
     return out;
 }
 
-std::string bintohex(const std::string &in) {
+// The value of a hex digit, -1 for anything else
+struct hex_digit_table {
+    int8_t values[256];
+};
+
+static constexpr hex_digit_table make_hex_digit_table() {
+    hex_digit_table table = {};
+    for (int c = 0; c < 256; c++) {
+        table.values[c] = -1;
+    }
+    for (int c = '0'; c <= '9'; c++) {
+        table.values[c] = static_cast<int8_t>(c - '0');
+    }
+    for (int c = 'a'; c <= 'f'; c++) {
+        table.values[c] = static_cast<int8_t>(c - 'a' + 10);
+        table.values[c - 'a' + 'A'] = static_cast<int8_t>(c - 'a' + 10);
+    }
+    return table;
+}
+
+static constexpr hex_digit_table hex_digits = make_hex_digit_table();
+
+#ifdef __SSE2__
+// Decode the 60 characters of 20 bytes that are all %XX, which is how most
+// clients send info hashes and peer ids. Returns false if the input is
+// anything else, which the scalar decoder then has to deal with
+static bool percent_decode_sse2(const char * in, uint8_t * out) {
+    alignas(16) char text[64];
+    alignas(16) uint8_t nibbles[64];
+    memcpy(text, in, 60);
+    memset(text + 60, '0', 4);
+    uint64_t percents = 0;
+    uint64_t digits = 0;
+    for (unsigned int i = 0; i < 64; i += 16) {
+        const __m128i chars = _mm_load_si128(reinterpret_cast<const __m128i *>(text + i));
+        const __m128i lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+        const __m128i is_decimal = _mm_and_si128(
+            _mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(chars, _mm_set1_epi8('9' + 1)));
+        const __m128i is_letter = _mm_and_si128(
+            _mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+        const __m128i values = _mm_or_si128(
+            _mm_and_si128(is_decimal, _mm_sub_epi8(chars, _mm_set1_epi8('0'))),
+            _mm_and_si128(is_letter, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+        _mm_store_si128(reinterpret_cast<__m128i *>(nibbles + i), values);
+        percents |= static_cast<uint64_t>(static_cast<uint16_t>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(chars, _mm_set1_epi8('%'))))) << i;
+        digits |= static_cast<uint64_t>(static_cast<uint16_t>(
+            _mm_movemask_epi8(_mm_or_si128(is_decimal, is_letter)))) << i;
+    }
+    // A '%' at every third character and hex digits in between
+    const uint64_t percent_positions = 0x0249249249249249ULL;
+    const uint64_t digit_positions = percent_positions << 1 | percent_positions << 2;
+    if ((percents & 0x0FFFFFFFFFFFFFFFULL) != percent_positions || (digits & digit_positions) != digit_positions) {
+        return false;
+    }
+    for (unsigned int i = 0; i < 20; i++) {
+        out[i] = static_cast<uint8_t>(nibbles[3 * i + 1] << 4 | nibbles[3 * i + 2]);
+    }
+    return true;
+}
+#endif
+
+// Decode a url encoded info hash or peer id straight into out. Unlike
+// hex_decode this is strict: every '%' has to be followed by two hex digits and
+// the input has to decode to exactly 20 bytes, otherwise it returns false
+bool percent_decode(std::string_view in, std::array<uint8_t, 20> &out) {
+#ifdef __SSE2__
+    if (in.size() == 60 && percent_decode_sse2(in.data(), out.data())) {
+        return true;
+    }
+#endif
+    size_t length = 0;
+    for (size_t i = 0; i < in.size(); i++) {
+        if (length == out.size()) {
+            return false;
+        }
+        uint8_t c = static_cast<uint8_t>(in[i]);
+        if (c == '%') {
+            if (i + 2 >= in.size()) {
+                return false;
+            }
+            int8_t high = hex_digits.values[static_cast<uint8_t>(in[i + 1])];
+            int8_t low = hex_digits.values[static_cast<uint8_t>(in[i + 2])];
+            if (high < 0 || low < 0) {
+                return false;
+            }
+            c = static_cast<uint8_t>(high << 4 | low);
+            i += 2;
+        }
+        out[length++] = c;
+    }
+    return length == out.size();
+}
+
+// Info hashes as they are stored in the database, false if it isn't 20 bytes
+bool infohash_from_binary(std::string_view in, infohash_t &out) {
+    if (in.size() != out.size()) {
+        return false;
+    }
+    memcpy(out.data(), in.data(), out.size());
+    return true;
+}
+
+// False if it isn't PASSKEY_LENGTH characters
+bool passkey_from_string(std::string_view in, passkey_t &out) {
+    if (in.size() != PASSKEY_LENGTH) {
+        return false;
+    }
+    memcpy(out.chars, in.data(), PASSKEY_LENGTH);
+    return true;
+}
+
+std::string bintohex(std::string_view in) {
     std::string out;
     size_t length = in.length();
     out.reserve(2*length);
@@ -83,3 +240,55 @@ std::string bintohex(const std::string &in) {
     }
     return out;
 }
+
+// Turn an IPv4 (4 bytes) or IPv6 (16 bytes) address into an ip_address
+void ip_from_binary(const void * bytes, bool ipv6, ip_address &ip) {
+    static const uint8_t v4_mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF };
+    const uint8_t * b = static_cast<const uint8_t *>(bytes);
+    if (ipv6 && memcmp(b, v4_mapped, sizeof(v4_mapped)) != 0) {
+        ip.family = IP_V6;
+        memcpy(ip.bytes, b, 16);
+    } else {
+        ip.family = IP_V4;
+        memcpy(ip.bytes, ipv6 ? b + 12 : b, 4);
+    }
+}
+
+void ip_from_sockaddr(const sockaddr_storage &addr, ip_address &ip) {
+    if (addr.ss_family == AF_INET) {
+        ip_from_binary(&reinterpret_cast<const sockaddr_in &>(addr).sin_addr, false, ip);
+    } else if (addr.ss_family == AF_INET6) {
+        ip_from_binary(&reinterpret_cast<const sockaddr_in6 &>(addr).sin6_addr, true, ip);
+    } else {
+        ip.family = IP_NONE;
+    }
+}
+
+// Parse an address given by the client or a proxy, returns false if it isn't one
+bool parse_ip(std::string_view text, ip_address &ip) {
+    char buf[INET6_ADDRSTRLEN];
+    uint8_t bytes[16];
+    ip.family = IP_NONE;
+    if (text.size() >= sizeof(buf)) {
+        return false;
+    }
+    memcpy(buf, text.data(), text.size());
+    buf[text.size()] = '\0';
+    if (inet_pton(AF_INET, buf, bytes) == 1) {
+        ip_from_binary(bytes, false, ip);
+        return true;
+    }
+    if (inet_pton(AF_INET6, buf, bytes) == 1) {
+        ip_from_binary(bytes, true, ip);
+        return true;
+    }
+    return false;
+}
+
+std::string ip_to_string(const ip_address &ip) {
+    char buf[INET6_ADDRSTRLEN];
+    if (ip.family == IP_NONE || inet_ntop(ip.family == IP_V4 ? AF_INET : AF_INET6, ip.bytes, buf, sizeof(buf)) == NULL) {
+        return "";
+    }
+    return buf;
+}
@@ -3,12 +3,34 @@
 
 // Copyright [2017-2024] Orpheus
 
+#include <sys/socket.h>
+
+#include <array>
 #include <string>
+#include <string_view>
+
+#include "ocelot.h"
+
+#define INT_BUFFER_SIZE 20  // characters of the longest int64_t, "-9223372036854775808"
+
+int32_t strtoint32(std::string_view str);
+int64_t strtoint64(std::string_view str);
+size_t format_int(char * buf, int64_t i);
+void append_int(std::string &out, int64_t i);
+std::string inttostr(int64_t i);
+std::string hex_decode(std::string_view in);
+bool percent_decode(std::string_view in, std::array<uint8_t, 20> &out);
+bool infohash_from_binary(std::string_view in, infohash_t &out);
+bool passkey_from_string(std::string_view in, passkey_t &out);
+std::string bintohex(std::string_view in);
+bool parse_ip(std::string_view text, ip_address &ip);
+std::string ip_to_string(const ip_address &ip);
+void ip_from_sockaddr(const sockaddr_storage &addr, ip_address &ip);
+void ip_from_binary(const void * bytes, bool ipv6, ip_address &ip);
 
-int32_t strtoint32(const std::string& str);
-int64_t strtoint64(const std::string& str);
-std::string inttostr(int i);
-std::string hex_decode(const std::string &in);
-std::string bintohex(const std::string &in);
+// The bytes of an info hash or peer id, for logging and queries
+inline std::string_view binary_view(const std::array<uint8_t, 20> &bytes) {
+    return std::string_view(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+}
 
 #endif  // SRC_MISC_FUNCTIONS_H_
@@ -16,6 +16,7 @@
 #include "db.h"
 #include "worker.h"
 #include "events.h"
+#include "scan.h"
 
 static connection_mother *mother;
 static worker *work;
@@ -147,6 +148,7 @@ int main(int argc, char **argv) {
         "Ocelot version " OCELOT_VERSION ", compiled " __DATE__ " "  __TIME__
     );
     spdlog::register_logger(combined_logger);
+    combined_logger->info(std::string("Scanning requests with ") + scan_implementation());
 
     db = new mysql(conf);
 
@@ -169,6 +171,7 @@ int main(int argc, char **argv) {
     stats.open_connections = 0;
     stats.peak_connections = 0;
     stats.opened_connections = 0;
+    stats.shed_connections = 0;
     stats.connection_rate = 0;
     stats.requests = 0;
     stats.request_rate = 0;
@@ -190,6 +193,8 @@ int main(int argc, char **argv) {
     stats.auth_error_announce_key = 0;
     stats.client_error = 0;
     stats.http_error = 0;
+    stats.peer_list_bytes = 0;
+    stats.bytes_per_peer = 0;
     stats.start_time = time(NULL);
 
     // Create worker object, which handles announces and scrapes and all that jazz
@@ -10,8 +10,12 @@
 #define OCELOT_VERSION "2.1.3"
 
 #include <time.h>
+#include <string.h>
 
+#include <algorithm>
+#include <array>
 #include <string>
+#include <string_view>
 #include <map>
 #include <vector>
 #include <unordered_map>
@@ -19,29 +23,79 @@
 #include <memory>
 #include <atomic>
 
+#include "dense_map.h"
+#include "flat_map.h"
+
 typedef uint32_t torid_t;
 typedef uint32_t userid_t;
 
 class user;
 typedef std::shared_ptr<user> user_ptr;
 
+enum ip_family : uint8_t { IP_NONE = 0, IP_V4 = 4, IP_V6 = 6 };
+
+// A binary IPv4 or IPv6 address in network byte order. IPv4 addresses use the
+// first four bytes, IPv4-mapped IPv6 addresses are stored as IPv4.
+struct ip_address {
+    ip_family family;
+    uint8_t bytes[16];
+
+    size_t size() const { return family == IP_V4 ? 4 : (family == IP_V6 ? 16 : 0); }
+    bool operator==(const ip_address &other) const {
+        return family == other.family && memcmp(bytes, other.bytes, size()) == 0;
+    }
+    bool operator!=(const ip_address &other) const { return !(*this == other); }
+};
+
+// A peer in its torrent's peer list, 80 bytes. The user id is kept next to the
+// flags so that peer selection can skip peers without going to the user. Times
+// are seconds since the tracker started, see peer_time()
 typedef struct {
     int64_t uploaded;
     int64_t downloaded;
     int64_t corrupt;
-    int64_t left;
-    time_t last_announced;
-    time_t first_announced;
+    user_ptr user;
+    userid_t userid;
+    uint32_t first_announced;
+    uint32_t last_announced;
     uint32_t announces;
+    ip_address ip;
+    bool visible : 1;
+    bool invalid_ip : 1;
+    bool seeding : 1;
     uint16_t port;
-    bool visible;
-    bool invalid_ip;
-    user_ptr user;
-    std::string ip_port;
-    std::string ip;
 } peer;
 
-typedef std::map<std::string, peer> peer_list;
+// Info hashes and peer ids are kept as the 20 bytes the client sent
+typedef std::array<uint8_t, 20> infohash_t;
+typedef std::array<uint8_t, 20> peerid_t;
+
+// Info hashes are SHA-1 digests, so their first bytes are already a good hash
+struct infohash_hasher {
+    size_t operator()(const infohash_t &info_hash) const {
+        size_t hash;
+        memcpy(&hash, info_hash.data(), sizeof(hash));
+        return hash;
+    }
+};
+
+// Peers are keyed by the user id (big-endian) and the peer id
+#define PEER_KEY_SIZE 24
+typedef std::array<uint8_t, PEER_KEY_SIZE> peer_key_t;
+
+// Peer ids start with the client name and version, the random part is at the
+// end. Mix that with the user id and the bytes after it
+struct peer_key_hasher {
+    size_t operator()(const peer_key_t &key) const {
+        uint64_t words[2];
+        memcpy(&words[0], key.data(), sizeof(words[0]));
+        memcpy(&words[1], key.data() + PEER_KEY_SIZE - sizeof(words[1]), sizeof(words[1]));
+        uint64_t hash = (words[0] ^ (words[1] * 0x9E3779B97F4A7C15ULL)) * 0xC2B2AE3D27D4EB4FULL;
+        return hash ^ (hash >> 29);
+    }
+};
+
+typedef dense_map<peer_key_t, peer, peer_key_hasher> peer_list;
 
 enum freetype { NORMAL, FREE, NEUTRAL };
 
@@ -53,7 +107,7 @@ typedef struct {
     time_t last_flushed;
     peer_list seeders;
     peer_list leechers;
-    std::string last_selected_seeder;
+    size_t next_seeder;  // where the next leecher starts going through the seeders
     std::set<userid_t> tokened_users;
 } torrent;
 
@@ -92,16 +146,48 @@ typedef struct {
     bool gzip;
     bool html;
     bool http_close;
+    bool proxy_protocol;  // the client address comes from a PROXY protocol header
 } client_opts_t;
 
-typedef std::unordered_map<std::string, torrent> torrent_list;
-typedef std::unordered_map<std::string, user_ptr> user_list;
+typedef flat_hash_map<infohash_t, torrent, infohash_hasher> torrent_list;
+// Passkeys are kept in place instead of in std::strings. They can be looked
+// up by a string_view into the request they came in
+#define PASSKEY_LENGTH 32
+
+struct passkey_t {
+    char chars[PASSKEY_LENGTH];
+};
+
+inline bool operator==(const passkey_t &a, const passkey_t &b) {
+    return memcmp(a.chars, b.chars, PASSKEY_LENGTH) == 0;
+}
+
+inline bool operator==(const passkey_t &a, std::string_view b) {
+    return b.size() == PASSKEY_LENGTH && memcmp(a.chars, b.data(), PASSKEY_LENGTH) == 0;
+}
+
+// Passkeys are random, but only in the characters they use. Mixing the first
+// 16 of them is plenty to spread them over the hash
+struct passkey_hasher {
+    size_t operator()(std::string_view passkey) const {
+        uint64_t words[2] = { 0, 0 };
+        memcpy(words, passkey.data(), std::min(passkey.size(), sizeof(words)));
+        uint64_t hash = (words[0] ^ (words[1] * 0x9E3779B97F4A7C15ULL)) * 0xC2B2AE3D27D4EB4FULL;
+        return hash ^ (hash >> 29);
+    }
+    size_t operator()(const passkey_t &passkey) const {
+        return (*this)(std::string_view(passkey.chars, PASSKEY_LENGTH));
+    }
+};
+
+typedef flat_hash_map<passkey_t, user_ptr, passkey_hasher> user_list;
 typedef std::unordered_map<std::string, std::string> params_type;
 
 struct stats_t {
     std::atomic<uint32_t> open_connections;
     std::atomic<uint32_t> peak_connections;
     std::atomic<uint64_t> opened_connections;
+    std::atomic<uint64_t> shed_connections;
     std::atomic<uint64_t> connection_rate;
     std::atomic<uint32_t> leechers;
     std::atomic<uint32_t> seeders;
@@ -123,9 +209,16 @@ struct stats_t {
     std::atomic<uint64_t> auth_error_announce_key;
     std::atomic<uint64_t> client_error;
     std::atomic<uint64_t> http_error;
+    std::atomic<uint64_t> peer_list_bytes;  // counted by the reaper, along with the next one
+    std::atomic<uint32_t> bytes_per_peer;
     time_t start_time;
 };
 extern struct stats_t stats;
 
+// Seconds since the tracker started, which fit in 32 bits for a century
+inline uint32_t peer_time(time_t t) {
+    return static_cast<uint32_t>(t - stats.start_time);
+}
+
 extern const char *version();
 #endif  // SRC_OCELOT_H_
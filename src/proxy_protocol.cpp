@@ -0,0 +1,59 @@
+// Copyright [2017-2024] Orpheus
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include "misc_functions.h"
+#include "proxy_protocol.h"
+
+#define PROXY_SIGNATURE "\r\n\r\n\0\r\nQUIT\n"
+#define PROXY_SIGNATURE_SIZE 12
+#define PROXY_HEADER_MIN_SIZE 16
+
+proxy_header_status parse_proxy_header(const char * data, size_t size, size_t max_size, size_t &header_size, ip_address &ip) {
+    const unsigned char * header = reinterpret_cast<const unsigned char *>(data);
+    if (memcmp(data, PROXY_SIGNATURE, std::min(size, static_cast<size_t>(PROXY_SIGNATURE_SIZE))) != 0) {
+        return PROXY_HEADER_INVALID;
+    }
+    if (size < PROXY_HEADER_MIN_SIZE) {
+        return PROXY_HEADER_INCOMPLETE;
+    }
+
+    // Version 2 in the high nibble, LOCAL (0) or PROXY (1) command in the low one
+    unsigned char version = header[12] >> 4;
+    unsigned char command = header[12] & 0x0F;
+    if (version != 2 || command > 1) {
+        return PROXY_HEADER_INVALID;
+    }
+    size_t address_size = (header[14] << 8) | header[15];
+    header_size = PROXY_HEADER_MIN_SIZE + address_size;
+    if (header_size > max_size) {
+        return PROXY_HEADER_INVALID;
+    }
+    if (size < header_size) {
+        return PROXY_HEADER_INCOMPLETE;
+    }
+    if (command == 0) {
+        return PROXY_HEADER_DONE;
+    }
+
+    // Address family in the high nibble, only TCP over IPv4 or IPv6 carries a client address.
+    // Anything else is passed on without one, as the specification asks.
+    const unsigned char * address = header + PROXY_HEADER_MIN_SIZE;
+    switch (header[13]) {
+        case 0x11:
+            if (address_size < 12) {
+                return PROXY_HEADER_INVALID;
+            }
+            ip_from_binary(address, false, ip);
+            break;
+        case 0x21:
+            if (address_size < 36) {
+                return PROXY_HEADER_INVALID;
+            }
+            ip_from_binary(address, true, ip);
+            break;
+    }
+    return PROXY_HEADER_DONE;
+}
@@ -0,0 +1,19 @@
+#ifndef SRC_PROXY_PROTOCOL_H_
+#define SRC_PROXY_PROTOCOL_H_
+
+// Copyright [2017-2024] Orpheus
+
+#include <string>
+
+#include "ocelot.h"
+
+enum proxy_header_status { PROXY_HEADER_INCOMPLETE, PROXY_HEADER_INVALID, PROXY_HEADER_DONE };
+
+/*
+Parse the PROXY protocol v2 header a load balancer sends before the first request.
+Once the header is complete, header_size is the number of bytes it took up and ip
+is the address of the client. A LOCAL header (e.g. a health check) leaves ip alone.
+*/
+proxy_header_status parse_proxy_header(const char * data, size_t size, size_t max_size, size_t &header_size, ip_address &ip);
+
+#endif  // SRC_PROXY_PROTOCOL_H_
@@ -0,0 +1,53 @@
+#ifndef SRC_RECORD_H_
+#define SRC_RECORD_H_
+
+// Copyright [2017-2024] Orpheus
+
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+
+#include "misc_functions.h"
+
+// Room for the longest record the worker builds, the one of a changed peer:
+// '(' and eleven integers of at most INT_BUFFER_SIZE characters with their commas
+#define RECORD_BUFFER_SIZE 256
+
+// Builds a database record on the stack. It replaces the stringstreams the
+// worker used, which allocated and looked at the locale on every announce.
+// Anything that doesn't fit is dropped, RECORD_BUFFER_SIZE leaves room for all records
+class record_buffer {
+ private:
+    char buf[RECORD_BUFFER_SIZE];
+    size_t length;
+
+ public:
+    record_buffer() : length(0) {}
+
+    record_buffer & operator<<(char c) {
+        if (length < RECORD_BUFFER_SIZE) {
+            buf[length++] = c;
+        }
+        return *this;
+    }
+
+    record_buffer & operator<<(std::string_view text) {
+        if (text.size() <= RECORD_BUFFER_SIZE - length) {
+            memcpy(buf + length, text.data(), text.size());
+            length += text.size();
+        }
+        return *this;
+    }
+
+    template <typename T, typename std::enable_if<std::is_integral<T>::value, int>::type = 0>
+    record_buffer & operator<<(T i) {
+        if (RECORD_BUFFER_SIZE - length >= INT_BUFFER_SIZE) {
+            length += format_int(buf + length, static_cast<int64_t>(i));
+        }
+        return *this;
+    }
+
+    std::string_view view() const { return std::string_view(buf, length); }
+};
+
+#endif  // SRC_RECORD_H_
@@ -93,6 +93,7 @@ std::string report(const uint32_t announce_interval, const uint32_t announce_jit
         << ITEM_NUM("open connections", stats.open_connections) << ','
         << ITEM_NUM("peak connections", stats.peak_connections) << ','
         << ITEM_NUM("connections/s", stats.connection_rate) << ','
+        << ITEM_NUM("connections shed", stats.shed_connections) << ','
         << ITEM_NUM("requests handled", stats.requests) << ','
         << ITEM_NUM("requests/s", stats.request_rate) << ','
         << ITEM_NUM("successful announcements", stats.succ_announcements) << ','
@@ -100,6 +101,8 @@ std::string report(const uint32_t announce_interval, const uint32_t announce_jit
         << ITEM_NUM("scrapes", stats.scrapes) << ','
         << ITEM_NUM("leechers tracked", stats.leechers) << ','
         << ITEM_NUM("seeders tracked", stats.seeders) << ','
+        << ITEM_BYTE("peer list memory", stats.peer_list_bytes) << ','
+        << ITEM_BYTE("bytes per peer", stats.bytes_per_peer) << ','
         << ITEM_NUM("items in user queue", stats.user_queue_size) << ','
         << ITEM_NUM("items in torrent queue", stats.torrent_queue_size) << ','
         << ITEM_NUM("items in peer queue", stats.peer_queue_size) << ','
@@ -155,6 +158,7 @@ std::string report_prom_stats(const char *jemalloc) {
         "#TYPE ocelot_peak_connections counter\n"
         "ocelot_peak_connections "    << stats.peak_connections << "\n"
         "ocelot_connection_rate "     << stats.connection_rate << "\n"
+        "ocelot_shed_connections "    << stats.shed_connections << "\n"
         "ocelot_requests "            << stats.requests << "\n"
         "ocelot_request_rate "        << stats.request_rate << "\n"
         "ocelot_succ_announcements "  << stats.succ_announcements << "\n"
@@ -162,6 +166,8 @@ std::string report_prom_stats(const char *jemalloc) {
         "ocelot_scrapes "             << stats.scrapes << "\n"
         "ocelot_leechers "            << stats.leechers << "\n"
         "ocelot_seeders "             << stats.seeders << "\n"
+        "ocelot_peer_list_bytes "     << stats.peer_list_bytes << "\n"
+        "ocelot_bytes_per_peer "      << stats.bytes_per_peer << "\n"
         "ocelot_user_queue "          << stats.user_queue_size << "\n"
         "ocelot_torrent_queue "       << stats.torrent_queue_size << "\n"
         "ocelot_peer_queue "          << stats.peer_queue_size << "\n"
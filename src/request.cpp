@@ -0,0 +1,347 @@
+// Copyright [2017-2024] Orpheus
+
+#include <algorithm>
+#include <cstring>
+
+#include "request.h"
+
+static const delimiter_set query_delimiters = { {'&', '=', ' '}, 3 };
+
+param_reader::param_reader(std::string_view query) :
+    text(query), scanner(query, query_delimiters), pos(0), end(std::string_view::npos), done(false) {
+}
+
+// Split off the next pair. A key without '=' gets an empty value, empty pairs are skipped.
+// Returns false once the query is exhausted
+bool param_reader::next(request_param &param) {
+    size_t key_end = std::string_view::npos;
+    while (!done) {
+        size_t delimiter = scanner.next();
+        if (delimiter != std::string_view::npos && text[delimiter] == '=') {
+            if (key_end == std::string_view::npos) {
+                key_end = delimiter;
+            }
+            continue;
+        }
+        size_t pair_end = delimiter == std::string_view::npos ? text.size() : delimiter;
+        if (delimiter == std::string_view::npos || text[delimiter] == ' ') {
+            done = true;
+            end = delimiter;
+        }
+        if (pair_end == pos) {
+            pos = pair_end + 1;
+            continue;
+        }
+        if (key_end == std::string_view::npos) {
+            param.key = text.substr(pos, pair_end - pos);
+            param.value = std::string_view();
+        } else {
+            param.key = text.substr(pos, key_end - pos);
+            param.value = text.substr(key_end + 1, pair_end - key_end - 1);
+        }
+        pos = pair_end + 1;
+        return true;
+    }
+    return false;
+}
+
+// Like the maps that used to hold the parameters, the last one with a key wins
+const request_param * request_t::find_param(std::string_view key) const {
+    for (size_t i = param_count; i > 0; i--) {
+        const request_param &p = param_at(i - 1);
+        if (p.key == key) {
+            return &p;
+        }
+    }
+    return NULL;
+}
+
+std::string_view request_t::param(std::string_view key) const {
+    const request_param * p = find_param(key);
+    return p == NULL ? std::string_view() : p->value;
+}
+
+static bool equals_lower(std::string_view text, std::string_view lower) {
+    if (text.size() != lower.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < text.size(); i++) {
+        char c = text[i];
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        if (c != lower[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Which of the headers we use this is, or REQUEST_HEADER_COUNT if none.
+// Header names are compared case-insensitively, telling them apart by length first
+static request_header find_header(std::string_view name) {
+    switch (name.size()) {
+        case 10:
+            if (equals_lower(name, "connection")) {
+                return HEADER_CONNECTION;
+            }
+            if (equals_lower(name, "user-agent")) {
+                return HEADER_USER_AGENT;
+            }
+            break;
+        case 15:
+            if (equals_lower(name, "x-forwarded-for")) {
+                return HEADER_FORWARDED_FOR;
+            }
+            if (equals_lower(name, "accept-encoding")) {
+                return HEADER_ACCEPT_ENCODING;
+            }
+            break;
+    }
+    return REQUEST_HEADER_COUNT;
+}
+
+static std::string_view trim(std::string_view text) {
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) {
+        text.remove_prefix(1);
+    }
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\t' || text.back() == '\r')) {
+        text.remove_suffix(1);
+    }
+    return text;
+}
+
+// What the request line is split at, and what the header lines are split at
+static const delimiter_set request_line_delimiters = { {'\n', ' ', '&', '=', '?'}, 5 };
+static const delimiter_set header_delimiters = { {'\n', ':'}, 2 };
+
+// The line is "GET /<passkey>/<action>?<query> HTTP/<version>". The action is
+// told by its first letter, which says where the '?' has to be
+#define ACTION_POSITION 38
+
+static size_t query_position(char c, request_action &action) {
+    switch (c) {
+        case 'a':
+            action = ACTION_ANNOUNCE;
+            return ACTION_POSITION + 8;
+        case 's':
+            action = ACTION_SCRAPE;
+            return ACTION_POSITION + 6;
+        case 'u':
+            action = ACTION_UPDATE;
+            return ACTION_POSITION + 6;
+        case 'r':
+            action = ACTION_REPORT;
+            return ACTION_POSITION + 6;
+    }
+    action = ACTION_INVALID;
+    return ACTION_POSITION;
+}
+
+void request_parser::reset() {
+    scanned = 0;
+    line_start = 0;
+    colon = std::string_view::npos;
+    request_line_end = std::string_view::npos;
+    state = LINE_PATH;
+    action = ACTION_INVALID;
+    query_start = std::string_view::npos;
+    query_end = std::string_view::npos;
+    pair_start = 0;
+    key_end = std::string_view::npos;
+    param_count = 0;
+    if (!extra_params.empty()) {
+        // Don't keep the room a long query took in a pooled connection
+        std::vector<param_location>().swap(extra_params);
+    }
+    too_many_params = false;
+    for (header_location &header : headers) {
+        header.start = 0;
+        header.length = 0;
+    }
+    complete = false;
+}
+
+// A pair of the query ends at pair_end. A key without '=' gets an empty value,
+// empty pairs are skipped, and so are the info hashes of a scrape
+void request_parser::end_pair(std::string_view text, size_t pair_end) {
+    if (pair_end != pair_start && !too_many_params) {
+        size_t pair_key_end = key_end == std::string_view::npos ? pair_end : key_end;
+        if (action != ACTION_SCRAPE || text.substr(pair_start, pair_key_end - pair_start) != "info_hash") {
+            if (param_count == MAX_REQUEST_PARAMS) {
+                too_many_params = true;
+            } else {
+                param_location location = param_location{static_cast<uint32_t>(pair_start),
+                    static_cast<uint32_t>(pair_key_end), static_cast<uint32_t>(pair_end)};
+                if (param_count < INLINE_REQUEST_PARAMS) {
+                    params[param_count] = location;
+                } else {
+                    extra_params.push_back(location);
+                }
+                param_count++;
+            }
+        }
+    }
+    pair_start = pair_end + 1;
+    key_end = std::string_view::npos;
+}
+
+// A delimiter on the request line before the query. Up to the action there
+// is nothing to look for, and the query starts at the '?' where the action
+// says it is. Anything else there means the request has no query
+void request_parser::path_delimiter(std::string_view text, size_t pos) {
+    if (pos < ACTION_POSITION) {
+        return;
+    }
+    size_t question_mark = query_position(text[ACTION_POSITION], action);
+    if (pos < question_mark) {
+        return;
+    }
+    if (pos == question_mark && text[pos] == '?') {
+        state = LINE_QUERY;
+        query_start = pair_start = pos + 1;
+    } else {
+        state = LINE_DONE;
+    }
+}
+
+// The first line is the request line, after that there is one header per line
+// until a blank one. Lines without a ':' and headers we don't use are skipped
+void request_parser::end_line(std::string_view text, size_t line_end) {
+    if (request_line_end == std::string_view::npos) {
+        if (state == LINE_QUERY) {
+            end_pair(text, line_end);
+        }
+        state = LINE_DONE;
+        request_line_end = line_end;
+    } else {
+        std::string_view line = text.substr(line_start, line_end - line_start);
+        if (line.empty() || line == "\r") {
+            complete = true;
+        } else if (colon != std::string_view::npos) {
+            size_t name_length = colon - line_start;
+            request_header header = find_header(trim(line.substr(0, name_length)));
+            if (header != REQUEST_HEADER_COUNT) {
+                std::string_view value = trim(line.substr(name_length + 1));
+                headers[header].start = value.data() - text.data();
+                headers[header].length = value.size();
+            }
+        }
+    }
+    line_start = line_end + 1;
+    colon = std::string_view::npos;
+}
+
+// The request line and the headers look for different delimiters, so the
+// scanner starts over with the header set once the request line has ended.
+// The query ends at the first space, which comes before the HTTP version
+bool request_parser::feed(std::string_view text) {
+    while (!complete && scanned < text.size()) {
+        const size_t base = scanned;
+        const bool request_line = request_line_end == std::string_view::npos;
+        delimiter_scanner scanner(text, request_line ? request_line_delimiters : header_delimiters, base);
+        scanned = text.size();
+        for (size_t pos = scanner.next(); pos != std::string_view::npos; pos = scanner.next()) {
+            char c = text[pos];
+            if (c == '\n') {
+                end_line(text, pos);
+                if (complete || request_line) {
+                    scanned = pos + 1;
+                    break;
+                }
+            } else if (!request_line) {
+                if (colon == std::string_view::npos) {
+                    colon = pos;
+                }
+            } else if (state == LINE_QUERY) {
+                if (c == '=') {
+                    if (key_end == std::string_view::npos) {
+                        key_end = pos;
+                    }
+                } else if (c == '&' || c == ' ') {
+                    end_pair(text, pos);
+                    if (c == ' ') {
+                        query_end = pos;
+                        state = LINE_DONE;
+                    }
+                }
+            } else if (state == LINE_PATH) {
+                path_delimiter(text, pos);
+            }
+        }
+    }
+    return complete;
+}
+
+request_param request_parser::make_param(std::string_view text, const param_location &p) {
+    request_param param;
+    param.key = text.substr(p.start, p.key_end - p.start);
+    if (p.key_end != p.end) {
+        param.value = text.substr(p.key_end + 1, p.end - p.key_end - 1);
+    }
+    return param;
+}
+
+request_status request_parser::finish(std::string_view text, request_t &req) {
+    // A request cut off before its blank line still gets its last line
+    if (!complete && line_start < text.size()) {
+        end_line(text, text.size());
+    }
+
+    req.size = text.size();
+    req.action = ACTION_INVALID;
+    req.param_count = 0;
+    req.extra_params.clear();
+    req.passkey = std::string_view();
+    req.query = std::string_view();
+    req.http_version = std::string_view();
+    std::string_view * fields[REQUEST_HEADER_COUNT] = {
+        &req.connection, &req.user_agent, &req.forwarded_for, &req.accept_encoding
+    };
+    for (int i = 0; i < REQUEST_HEADER_COUNT; i++) {
+        *fields[i] = text.substr(headers[i].start, headers[i].length);
+    }
+
+    if (text.size() < 60) {  // Way too short to be anything useful
+        return REQUEST_TOO_SHORT;
+    }
+    std::string_view line = text.substr(0, std::min(request_line_end, text.size()));
+    if (line.size() <= ACTION_POSITION - 1 || line[ACTION_POSITION - 1] != '/') {
+        return REQUEST_MALFORMED;
+    }
+    req.passkey = line.substr(5, 32);  // skip 'GET /'
+    if (line.size() > ACTION_POSITION) {
+        query_position(line[ACTION_POSITION], req.action);
+    }
+    if (query_start == std::string_view::npos) {
+        return REQUEST_NO_PARAMS;
+    }
+    for (size_t i = 0; i < param_count && i < INLINE_REQUEST_PARAMS; i++) {
+        req.params[i] = make_param(text, params[i]);
+    }
+    for (const param_location &p : extra_params) {
+        req.extra_params.push_back(make_param(text, p));
+    }
+    req.param_count = param_count;
+    if (too_many_params) {
+        return REQUEST_TOO_MANY_PARAMS;
+    }
+    if (query_end == std::string_view::npos) {
+        return REQUEST_BAD_HTTP;
+    }
+    req.query = line.substr(query_start, query_end - query_start);
+
+    size_t version = query_end + 1;
+    if (line.compare(version, 5, "HTTP/") != 0) {
+        return REQUEST_BAD_HTTP;
+    }
+    req.http_version = trim(line.substr(version + 5));
+    return REQUEST_OK;
+}
+
+// Parse a request that is all in input, the way a connection does it piece by piece
+request_status parse_request(std::string_view input, request_t &req) {
+    request_parser parser;
+    parser.feed(input);
+    return parser.finish(input.substr(0, parser.size()), req);
+}
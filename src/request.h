@@ -0,0 +1,142 @@
+#ifndef SRC_REQUEST_H_
+#define SRC_REQUEST_H_
+
+// Copyright [2017-2024] Orpheus
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "scan.h"
+
+// Requests with more parameters than this are answered with "Too many
+// parameters". Clients send around 15, and max_request_size caps them anyway
+#define MAX_REQUEST_PARAMS 256
+// Parameters kept in place; any beyond these go to a vector
+#define INLINE_REQUEST_PARAMS 32
+
+enum request_action { ACTION_INVALID = 0, ACTION_ANNOUNCE, ACTION_SCRAPE, ACTION_UPDATE, ACTION_REPORT };
+
+enum request_status {
+    REQUEST_OK,
+    REQUEST_TOO_SHORT,
+    REQUEST_MALFORMED,  // no '/' after the passkey
+    REQUEST_NO_PARAMS,  // no query string, probably not a torrent client
+    REQUEST_TOO_MANY_PARAMS,
+    REQUEST_BAD_HTTP
+};
+
+// The headers the tracker reads
+enum request_header {
+    HEADER_CONNECTION = 0,
+    HEADER_USER_AGENT,
+    HEADER_FORWARDED_FOR,
+    HEADER_ACCEPT_ENCODING,
+    REQUEST_HEADER_COUNT
+};
+
+struct request_param {
+    std::string_view key;
+    std::string_view value;
+};
+
+// Reads the key=value pairs of a query string in order, up to the space that ends it
+class param_reader {
+ private:
+    std::string_view text;
+    delimiter_scanner scanner;
+    size_t pos;  // start of the next pair
+    size_t end;  // the space that ended the query, or npos
+    bool done;
+
+ public:
+    explicit param_reader(std::string_view query);
+    bool next(request_param &param);
+    size_t query_end() const { return end; }
+};
+
+// A request line and the headers we use as views into the buffer the request was
+// read into, so nothing is copied or allocated while parsing. The views are
+// only valid as long as that buffer is.
+// The info_hash parameters of a scrape are not kept in params, read the query
+// with a param_reader to get them all.
+struct request_t {
+    size_t size;  // of the request line and headers
+    std::string_view passkey;
+    request_action action;
+    std::string_view query;
+    std::string_view http_version;
+    request_param params[INLINE_REQUEST_PARAMS];
+    std::vector<request_param> extra_params;  // the ones after the first INLINE_REQUEST_PARAMS
+    size_t param_count;
+    // The only headers the tracker reads, empty if the client didn't send them
+    std::string_view connection;
+    std::string_view user_agent;
+    std::string_view forwarded_for;
+    std::string_view accept_encoding;
+
+    const request_param & param_at(size_t i) const {
+        return i < INLINE_REQUEST_PARAMS ? params[i] : extra_params[i - INLINE_REQUEST_PARAMS];
+    }
+    const request_param * find_param(std::string_view key) const;
+    std::string_view param(std::string_view key) const;  // empty if missing
+};
+
+// Parses a request as it arrives. Every call to feed() only indexes the bytes
+// added since the last one with a delimiter_scanner, so a request that
+// trickles in over many reads is still scanned once, and the request line is
+// split into its parameters on the way. Only offsets are kept, since the
+// buffer may move between reads. Lines are split as they complete and the
+// headers we use are located then. finish() turns the offsets into a request_t.
+class request_parser {
+ private:
+    struct header_location {
+        size_t start;
+        size_t length;
+    };
+    // Requests are far shorter than 4 GB, and there are a lot of these
+    struct param_location {
+        uint32_t start;
+        uint32_t key_end;  // end if the pair has no '='
+        uint32_t end;
+    };
+    // Where the request line is: before the query, in it, or past it
+    enum line_state { LINE_PATH, LINE_QUERY, LINE_DONE };
+
+    size_t scanned;  // bytes looked at, the size of the request once it is complete
+    size_t line_start;
+    size_t colon;  // the first ':' of the current header line, or npos
+    size_t request_line_end;  // npos until the first line break
+    line_state state;
+    request_action action;
+    size_t query_start;  // npos if there is no query
+    size_t query_end;  // the space after the query, or npos
+    size_t pair_start;
+    size_t key_end;
+    param_location params[INLINE_REQUEST_PARAMS];
+    std::vector<param_location> extra_params;
+    size_t param_count;
+    bool too_many_params;
+    header_location headers[REQUEST_HEADER_COUNT];
+    bool complete;
+
+    void path_delimiter(std::string_view text, size_t pos);
+    void end_pair(std::string_view text, size_t pair_end);
+    void end_line(std::string_view text, size_t line_end);
+    static request_param make_param(std::string_view text, const param_location &p);
+
+ public:
+    request_parser() { reset(); }
+    void reset();
+    // text is all of the request received so far, from its first byte.
+    // Returns true once a blank line has ended the headers
+    bool feed(std::string_view text);
+    size_t size() const { return scanned; }
+    // Fill req from the request in text, which is complete unless the
+    // connection gave up on it. The views in req point into text
+    request_status finish(std::string_view text, request_t &req);
+};
+
+request_status parse_request(std::string_view input, request_t &req);
+
+#endif  // SRC_REQUEST_H_
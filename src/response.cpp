@@ -1,7 +1,9 @@
 // Copyright [2017-2024] Orpheus
 
 #include <algorithm>
+#include <cstdio>
 #include <sstream>
+#include <utility>
 
 #include <boost/iostreams/filtering_streambuf.hpp>
 #include <boost/iostreams/copy.hpp>
@@ -10,28 +12,82 @@
 #include "misc_functions.h"
 #include "response.h"
 
-const std::string http_head(size_t content_length, client_opts_t &client_opts) {
-    const std::string content_type = client_opts.html ? "text/html" : "text/plain";
+// rely on preprocessor string concatenation
+#define HTTP_HEAD_PREFIX(content_type) "HTTP/1.1 200 OK\r\nServer: Ocelot " OCELOT_VERSION "\r\nContent-Type: " content_type "\r\n"
+static const char http_prefix_plain[] = HTTP_HEAD_PREFIX("text/plain");
+static const char http_prefix_html[] = HTTP_HEAD_PREFIX("text/html");
 
-    // rely on preprocessor string concatenation
-    std::string head = "HTTP/1.1 200 OK\r\nServer: Ocelot " OCELOT_VERSION "\r\n"
-        "Content-Type: " + content_type + "\r\n"
-        "Content-Length: " + inttostr(content_length) + "\r\n";
-    if (client_opts.gzip) {
-        head += "Content-Encoding: gzip\r\n";
+// Fill iov with whatever is left to send after the first offset bytes and return the number of entries used
+int response_t::get_iovec(struct iovec * iov, size_t offset) const {
+    const char * parts[3] = { prefix, head, body.data() };
+    size_t sizes[3] = { prefix_size, head_size, body.size() };
+    int count = 0;
+    for (int i = 0; i < 3; i++) {
+        if (offset >= sizes[i]) {
+            offset -= sizes[i];
+            continue;
+        }
+        iov[count].iov_base = const_cast<char *>(parts[i] + offset);
+        iov[count].iov_len = sizes[i] - offset;
+        offset = 0;
+        count++;
+    }
+    return count;
+}
+
+void response_t::clear() {
+    prefix = NULL;
+    prefix_size = 0;
+    head_size = 0;
+    body.clear();
+}
+
+// Fill iov with the unsent parts of as many queued responses as fit and return the number of entries used
+int response_queue::get_iovec(struct iovec * iov) const {
+    int count = 0;
+    size_t offset = written;
+    for (auto it = responses.begin(); it != responses.end() && count + 3 <= RESPONSE_QUEUE_IOV; ++it) {
+        count += it->get_iovec(iov + count, offset);
+        offset = 0;
     }
-    if (client_opts.http_close) {
-        head += "Connection: Close\r\n";
+    return count;
+}
+
+// Drop whatever a send has taken off the front of the queue
+void response_queue::consume(size_t bytes) {
+    auto it = responses.begin();
+    while (it != responses.end() && bytes >= it->size() - written) {
+        bytes -= it->size() - written;
+        written = 0;
+        ++it;
     }
-    return head + "\r\n";
+    responses.erase(responses.begin(), it);
+    written += bytes;
 }
 
-const std::string http_response(const std::string &body, client_opts_t &client_opts) {
-    std::string out;
-    bool processed = false;
+void response_queue::clear() {
+    responses.clear();
+    written = 0;
+}
+
+static void http_head(response_t &response, client_opts_t &client_opts) {
     if (client_opts.html) {
-        out = "<html><head><meta name=\"robots\" content=\"noindex, nofollow\" /></head><body>" + body + "</body></html>";
-        processed = true;
+        response.prefix = http_prefix_html;
+        response.prefix_size = sizeof(http_prefix_html) - 1;
+    } else {
+        response.prefix = http_prefix_plain;
+        response.prefix_size = sizeof(http_prefix_plain) - 1;
+    }
+    response.head_size = snprintf(response.head, sizeof(response.head), "Content-Length: %zu\r\n%s%s\r\n",
+        response.body.size(),
+        client_opts.gzip ? "Content-Encoding: gzip\r\n" : "",
+        client_opts.http_close ? "Connection: Close\r\n" : "");
+}
+
+response_t http_response(std::string body, client_opts_t &client_opts) {
+    response_t response;
+    if (client_opts.html) {
+        body = "<html><head><meta name=\"robots\" content=\"noindex, nofollow\" /></head><body>" + body + "</body></html>";
     }
     if (client_opts.gzip) {
         std::stringstream ss, zss;
@@ -40,16 +96,14 @@ const std::string http_response(const std::string &body, client_opts_t &client_o
         in.push(boost::iostreams::gzip_compressor());
         in.push(ss);
         boost::iostreams::copy(in, zss);
-        out = zss.str();
-        processed = true;
-    }
-    if (processed) {
-        return http_head(out.length(), client_opts) + out;
+        body = zss.str();
     }
-    return http_head(body.length(), client_opts) + body;
+    response.body = std::move(body);
+    http_head(response, client_opts);
+    return response;
 }
 
-const std::string error(const std::string &message, client_opts_t &client_opts) {
+response_t error(const std::string &message, client_opts_t &client_opts) {
     return http_response(
         "d14:failure reason" + inttostr(message.length()) + ':' + message
             + "12:min intervali5400e8:intervali5400ee",
@@ -3,11 +3,48 @@
 
 // Copyright [2017-2024] Orpheus
 
+#include <sys/uio.h>
+
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "ocelot.h"
 
-const std::string http_response(const std::string &body, client_opts_t &client_opts);
-const std::string error(const std::string &err, client_opts_t &client_opts);
+// A response kept in the pieces it is sent in: a static header prefix, the
+// header lines that depend on the body, and the body itself. The pieces go out
+// with a single sendmsg so the body is never copied behind the header.
+struct response_t {
+    const char * prefix;
+    size_t prefix_size;
+    char head[96];
+    size_t head_size;
+    std::string body;
+
+    response_t() : prefix(NULL), prefix_size(0), head_size(0) {}
+    size_t size() const { return prefix_size + head_size + body.size(); }
+    int get_iovec(struct iovec * iov, size_t offset) const;
+    void clear();
+};
+
+#define RESPONSE_QUEUE_IOV 48  // iovecs handed to one sendmsg, three per response
+
+// Responses to pipelined requests, sent in the order the requests came in
+class response_queue {
+ private:
+    std::vector<response_t> responses;
+    size_t written;  // bytes of the first response that have been sent
+
+ public:
+    response_queue() : written(0) {}
+    bool empty() const { return responses.empty(); }
+    void push(response_t &&response) { responses.push_back(std::move(response)); }
+    int get_iovec(struct iovec * iov) const;
+    void consume(size_t bytes);
+    void clear();
+};
+
+response_t http_response(std::string body, client_opts_t &client_opts);
+response_t error(const std::string &err, client_opts_t &client_opts);
 
 #endif  // SRC_RESPONSE_H_
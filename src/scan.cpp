@@ -0,0 +1,125 @@
+// Copyright [2017-2024] Orpheus
+
+#include <algorithm>
+#include <cstring>
+
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+static void scan_scalar(const char * data, size_t blocks, const delimiter_set &set, uint64_t * masks) {
+    uint8_t is_delimiter[256] = {};
+    for (unsigned int j = 0; j < set.count; j++) {
+        is_delimiter[static_cast<uint8_t>(set.chars[j])] = 1;
+    }
+    for (size_t b = 0; b < blocks; b++) {
+        const uint8_t * block = reinterpret_cast<const uint8_t *>(data + b * 64);
+        uint64_t mask = 0;
+        for (unsigned int i = 0; i < 64; i++) {
+            mask |= static_cast<uint64_t>(is_delimiter[block[i]]) << i;
+        }
+        masks[b] = mask;
+    }
+}
+
+#ifdef SCAN_X86
+// Compare each half of a block against every delimiter
+__attribute__((target("avx2")))
+static void scan_avx2(const char * data, size_t blocks, const delimiter_set &set, uint64_t * masks) {
+    __m256i delimiters[16];
+    for (unsigned int j = 0; j < set.count; j++) {
+        delimiters[j] = _mm256_set1_epi8(set.chars[j]);
+    }
+    for (size_t b = 0; b < blocks; b++) {
+        const char * block = data + b * 64;
+        __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block));
+        __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block + 32));
+        __m256i low_match = _mm256_cmpeq_epi8(low, delimiters[0]);
+        __m256i high_match = _mm256_cmpeq_epi8(high, delimiters[0]);
+        for (unsigned int j = 1; j < set.count; j++) {
+            low_match = _mm256_or_si256(low_match, _mm256_cmpeq_epi8(low, delimiters[j]));
+            high_match = _mm256_or_si256(high_match, _mm256_cmpeq_epi8(high, delimiters[j]));
+        }
+        uint64_t low_mask = static_cast<uint32_t>(_mm256_movemask_epi8(low_match));
+        uint64_t high_mask = static_cast<uint32_t>(_mm256_movemask_epi8(high_match));
+        masks[b] = low_mask | (high_mask << 32);
+    }
+}
+
+// PCMPESTRM matches 16 bytes against the whole set in one instruction
+__attribute__((target("sse4.2")))
+static void scan_sse42(const char * data, size_t blocks, const delimiter_set &set, uint64_t * masks) {
+    const __m128i delimiters = _mm_loadu_si128(reinterpret_cast<const __m128i *>(set.chars));
+    const int count = static_cast<int>(set.count);
+    for (size_t b = 0; b < blocks; b++) {
+        uint64_t mask = 0;
+        for (unsigned int i = 0; i < 64; i += 16) {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + b * 64 + i));
+            __m128i match = _mm_cmpestrm(delimiters, count, bytes, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK);
+            mask |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_cvtsi128_si32(match))) << i;
+        }
+        masks[b] = mask;
+    }
+}
+#endif
+
+struct scan_choice {
+    scan_function function;
+    const char * name;
+};
+
+static scan_choice choose_scan() {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return scan_choice{scan_avx2, "avx2"};
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        return scan_choice{scan_sse42, "sse4.2"};
+    }
+#endif
+    return scan_choice{scan_scalar, "scalar"};
+}
+
+// Chosen on first use, so scanning works during static initialisation too
+static const scan_choice &get_scan() {
+    static const scan_choice scan = choose_scan();
+    return scan;
+}
+
+scan_function get_scan_function() {
+    return get_scan().function;
+}
+
+const char * scan_implementation() {
+    return get_scan().name;
+}
+
+// Index the chunk at offset chunk. A partial last block is read as the last
+// 64 bytes of the text, or copied out if the text is shorter than that, so
+// nothing is read past the end
+void delimiter_scanner::load() {
+    current = 0;
+    size_t left = size - chunk;
+    size_t whole = std::min<size_t>(left / 64, SCAN_BLOCKS);
+    scan(data + chunk, whole, *set, masks);
+    blocks = whole;
+    if (whole < SCAN_BLOCKS) {
+        size_t tail_size = left - whole * 64;
+        uint64_t tail_mask = 0;
+        if (tail_size > 0 && size >= 64) {
+            scan(data + size - 64, 1, *set, &tail_mask);
+            tail_mask >>= 64 - tail_size;
+        } else if (tail_size > 0) {
+            char tail[64] = {};
+            memcpy(tail, data + chunk + whole * 64, tail_size);
+            scan(tail, 1, *set, &tail_mask);
+            tail_mask &= (1ULL << tail_size) - 1;
+        }
+        masks[blocks++] = tail_mask;
+    }
+    mask = masks[0];
+}
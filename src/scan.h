@@ -0,0 +1,67 @@
+#ifndef SRC_SCAN_H_
+#define SRC_SCAN_H_
+
+// Copyright [2017-2024] Orpheus
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Up to 16 bytes to look for at once
+struct delimiter_set {
+    char chars[16];  // only the first count are used
+    unsigned int count;
+};
+
+#define SCAN_BLOCKS 8  // 64 byte blocks indexed at a time
+
+// Sets bit i of masks[b] if byte 64 * b + i of data is a delimiter, for the given number of whole blocks
+typedef void (*scan_function)(const char * data, size_t blocks, const delimiter_set &set, uint64_t * masks);
+scan_function get_scan_function();
+const char * scan_implementation();
+
+// Walks the positions of the delimiters in a text in order.
+// The text is indexed SCAN_BLOCKS * 64 bytes at a time into bit masks with AVX2 or
+// SSE4.2 when the CPU has them, or with a plain loop otherwise, and every byte is
+// looked at once however many delimiters there are.
+class delimiter_scanner {
+ private:
+    const char * data;
+    size_t size;
+    const delimiter_set * set;
+    scan_function scan;
+    size_t chunk;  // offset of the bytes in masks
+    unsigned int blocks;  // valid entries of masks
+    unsigned int current;  // block of masks in mask
+    uint64_t mask;  // delimiters of the current block that haven't been returned yet
+    uint64_t masks[SCAN_BLOCKS];
+
+    void load();
+
+ public:
+    // Scanning starts at offset start, and positions are counted from the start of text
+    delimiter_scanner(std::string_view text, const delimiter_set &delimiters, size_t start = 0) :
+        data(text.data()), size(text.size()), set(&delimiters), scan(get_scan_function()), chunk(start) {
+        load();
+    }
+
+    // Position of the next delimiter, or npos
+    size_t next() {
+        while (mask == 0) {
+            if (++current == blocks) {
+                if (chunk + SCAN_BLOCKS * 64 >= size) {
+                    current--;
+                    return std::string_view::npos;
+                }
+                chunk += SCAN_BLOCKS * 64;
+                load();
+            }
+            mask = masks[current];
+        }
+        size_t pos = chunk + current * 64 + __builtin_ctzll(mask);
+        mask &= mask - 1;
+        return pos;
+    }
+};
+
+#endif  // SRC_SCAN_H_
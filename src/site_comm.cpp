@@ -42,6 +42,7 @@ bool site_comm::all_clear() {
 void site_comm::expire_token(int torrent, int user) {
     std::stringstream token_pair;
     token_pair << user << ':' << torrent;
+    std::lock_guard<std::mutex> lock(expire_queue_lock);
     if (!expire_token_buffer.empty()) {
         expire_token_buffer += ",";
     }
@@ -49,7 +50,6 @@ void site_comm::expire_token(int torrent, int user) {
     if (expire_token_buffer.length() > 350) {
         logger->info("Flushing overloaded token buffer");
         if (!readonly) {
-            std::lock_guard<std::mutex> lock(expire_queue_lock);
             token_queue.push(expire_token_buffer);
         }
         expire_token_buffer.clear();
@@ -58,11 +58,11 @@ void site_comm::expire_token(int torrent, int user) {
 
 void site_comm::flush_tokens()
 {
+    std::lock_guard<std::mutex> lock(expire_queue_lock);
     if (readonly) {
         expire_token_buffer.clear();
         return;
     }
-    std::lock_guard<std::mutex> lock(expire_queue_lock);
     size_t qsize = token_queue.size();
     if (verbose_flush || qsize > 0) {
         logger->info("Token expire queue size: " + std::to_string(qsize));
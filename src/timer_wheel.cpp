@@ -0,0 +1,56 @@
+// Copyright [2017-2024] Orpheus
+
+#include <algorithm>
+
+#include "timer_wheel.h"
+
+timer_wheel::timer_wheel(time_t now) : start(now), current(0) {
+}
+
+void timer_wheel::insert(timer_node * node) {
+    timer_link * head;
+    if (node->expires - current < LEVEL0_SIZE) {
+        head = &level0[node->expires & (LEVEL0_SIZE - 1)];
+    } else {
+        head = &level1[(node->expires >> LEVEL0_BITS) % LEVEL1_SIZE];
+    }
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+// (Re)arm a node to expire in timeout seconds
+void timer_wheel::arm(timer_node * node, unsigned int timeout) {
+    node->unlink();
+    // A second level slot must not be reused before it is due
+    timeout = std::min(std::max(timeout, 1u), (LEVEL1_SIZE - 1) * LEVEL0_SIZE);
+    node->expires = current + timeout;
+    insert(node);
+}
+
+// Expire everything that is due at or before now
+void timer_wheel::advance(time_t now) {
+    if (now <= start) {
+        return;
+    }
+    uint32_t target = static_cast<uint32_t>(now - start);
+    while (current < target) {
+        current++;
+        if ((current & (LEVEL0_SIZE - 1)) == 0) {
+            // Move the timers due in the next 256 seconds down to the first level
+            timer_link * head = &level1[(current >> LEVEL0_BITS) % LEVEL1_SIZE];
+            while (head->linked()) {
+                timer_node * node = static_cast<timer_node *>(head->next);
+                node->unlink();
+                insert(node);
+            }
+        }
+        timer_link * head = &level0[current & (LEVEL0_SIZE - 1)];
+        while (head->linked()) {
+            timer_node * node = static_cast<timer_node *>(head->next);
+            node->unlink();
+            node->expire();
+        }
+    }
+}
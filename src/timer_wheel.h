@@ -0,0 +1,68 @@
+#ifndef SRC_TIMER_WHEEL_H_
+#define SRC_TIMER_WHEEL_H_
+
+// Copyright [2017-2024] Orpheus
+
+#include <stdint.h>
+
+#include <ctime>
+
+// Link in a circular doubly linked list. A link that points to itself is unlinked.
+struct timer_link {
+    timer_link * prev;
+    timer_link * next;
+
+    timer_link() : prev(this), next(this) {}
+    timer_link(const timer_link &) = delete;
+    timer_link &operator=(const timer_link &) = delete;
+    bool linked() const { return next != this; }
+    void unlink() {
+        prev->next = next;
+        next->prev = prev;
+        prev = next = this;
+    }
+};
+
+// Anything that can time out. Destroying a node takes it off the wheel.
+class timer_node : public timer_link {
+    friend class timer_wheel;
+    uint32_t expires;
+
+ public:
+    virtual ~timer_node() { unlink(); }
+    void disarm() { unlink(); }
+
+    // Called by the wheel once the node is due. The node is already unlinked,
+    // so it may delete itself.
+    virtual void expire() = 0;
+};
+
+/*
+A two level timer wheel with one second ticks, owned by one event loop.
+The first level has one slot per second for the next 256 seconds, the second
+level has one slot per 256 seconds, and its due slot is moved down to the
+first level every 256 seconds. Arming and disarming are O(1) and advancing
+only looks at the due slots. Timeouts are clamped to about four and a half hours.
+Times are whole seconds on a clock that doesn't jump, see monotonic_time(), so
+setting the wall clock neither expires everything nor stalls the wheel.
+*/
+class timer_wheel {
+ private:
+    static const unsigned int LEVEL0_BITS = 8;
+    static const unsigned int LEVEL0_SIZE = 1 << LEVEL0_BITS;
+    static const unsigned int LEVEL1_SIZE = 64;
+
+    timer_link level0[LEVEL0_SIZE];
+    timer_link level1[LEVEL1_SIZE];
+    time_t start;
+    uint32_t current;  // ticks since start
+
+    void insert(timer_node * node);
+
+ public:
+    timer_wheel(time_t now);
+    void arm(timer_node * node, unsigned int timeout);
+    void advance(time_t now);
+};
+
+#endif  // SRC_TIMER_WHEEL_H_
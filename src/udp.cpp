@@ -0,0 +1,274 @@
+// Copyright [2017-2024] Orpheus
+
+#include <arpa/inet.h>
+#include <endian.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#include "ocelot.h"
+#include "config.h"
+#include "db.h"
+#include "worker.h"
+#include "misc_functions.h"
+#include "udp.h"
+
+#define UDP_PROTOCOL_ID 0x41727101980ULL
+#define UDP_MAX_PACKET 2048
+#define UDP_MAX_SCRAPE 74  // info hashes that fit in a scrape packet
+
+enum udp_action { UDP_CONNECT = 0, UDP_ANNOUNCE, UDP_SCRAPE, UDP_ERROR };
+
+static inline uint32_t read32(const unsigned char * p) {
+    uint32_t x;
+    memcpy(&x, p, sizeof(x));
+    return be32toh(x);
+}
+
+static inline uint64_t read64(const unsigned char * p) {
+    uint64_t x;
+    memcpy(&x, p, sizeof(x));
+    return be64toh(x);
+}
+
+static inline void append32(std::string &out, uint32_t x) {
+    x = htobe32(x);
+    out.append(reinterpret_cast<const char *>(&x), sizeof(x));
+}
+
+static inline void append64(std::string &out, uint64_t x) {
+    x = htobe64(x);
+    out.append(reinterpret_cast<const char *>(&x), sizeof(x));
+}
+
+// SipHash-2-4 of a few words, so connection IDs can't be forged without the key
+static uint64_t siphash(const uint64_t * key, const uint64_t * words, size_t count) {
+    uint64_t v0 = key[0] ^ 0x736f6d6570736575ULL;
+    uint64_t v1 = key[1] ^ 0x646f72616e646f6dULL;
+    uint64_t v2 = key[0] ^ 0x6c7967656e657261ULL;
+    uint64_t v3 = key[1] ^ 0x7465646279746573ULL;
+#define ROTL(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND do { \
+        v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32); \
+        v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2; \
+        v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0; \
+        v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32); \
+    } while (0)
+    for (size_t i = 0; i <= count; i++) {
+        uint64_t m = i < count ? words[i] : static_cast<uint64_t>(count * 8) << 56;
+        v3 ^= m;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m;
+    }
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+#undef SIPROUND
+#undef ROTL
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+udp_tracker::udp_tracker(int udp_sock, struct ev_loop * loop, worker * worker_obj, const uint64_t * key, unsigned int budget) :
+    sock(udp_sock), work(worker_obj), cookie_key(key), read_budget(budget) {
+    logger = spdlog::get("logger");
+    read_event.set(loop);
+    read_event.set<udp_tracker, &udp_tracker::handle_read>(this);
+    read_event.start(sock, ev::READ);
+}
+
+udp_tracker::~udp_tracker() {
+    read_event.stop();
+    close(sock);
+}
+
+uint64_t udp_tracker::connection_id(const sockaddr_storage &addr, uint64_t minute) {
+    ip_address ip;
+    ip_from_sockaddr(addr, ip);
+    uint16_t port = addr.ss_family == AF_INET6 ? reinterpret_cast<const sockaddr_in6 &>(addr).sin6_port
+        : reinterpret_cast<const sockaddr_in &>(addr).sin_port;
+    uint64_t words[4] = { 0, 0, (static_cast<uint64_t>(ip.family) << 16) | port, minute };
+    memcpy(words, ip.bytes, ip.size());
+    return siphash(cookie_key, words, 4);
+}
+
+bool udp_tracker::valid_connection_id(uint64_t id, const sockaddr_storage &addr) {
+    uint64_t minute = time(NULL) / 60;
+    return id == connection_id(addr, minute) || id == connection_id(addr, minute - 1);
+}
+
+// Read packets until the socket is empty, but give the other watchers on this loop a turn after read_budget of them
+void udp_tracker::handle_read(ev::io &watcher, int events_flags) {
+    unsigned char packet[UDP_MAX_PACKET];
+    for (unsigned int i = 0; i < read_budget; i++) {
+        sockaddr_storage addr;
+        socklen_t addr_len = sizeof(addr);
+        ssize_t size = recvfrom(sock, packet, sizeof(packet), 0, (sockaddr *) &addr, &addr_len);
+        if (size == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                logger->error("UDP receive failed: " + std::string(strerror(errno)));
+            }
+            return;
+        }
+        stats.bytes_read += size;
+        if (addr.ss_family != AF_INET && addr.ss_family != AF_INET6) {
+            continue;
+        }
+
+        reply.clear();
+        handle_packet(packet, size, addr);
+        if (!reply.empty()) {
+            ssize_t ret = sendto(sock, reply.data(), reply.size(), 0, (sockaddr *) &addr, addr_len);
+            if (ret > 0) {
+                stats.bytes_written += ret;
+            }
+        }
+    }
+}
+
+void udp_tracker::handle_packet(const unsigned char * packet, size_t size, const sockaddr_storage &addr) {
+    if (size < 16) {
+        return;
+    }
+    uint64_t id = read64(packet);
+    uint32_t action = read32(packet + 8);
+    uint32_t transaction_id = read32(packet + 12);
+    stats.requests++;
+
+    if (action == UDP_CONNECT) {
+        if (id != UDP_PROTOCOL_ID) {
+            return;
+        }
+        append32(reply, UDP_CONNECT);
+        append32(reply, transaction_id);
+        append64(reply, connection_id(addr, time(NULL) / 60));
+        return;
+    }
+
+    // Don't answer spoofed packets, they would only make us part of a reflection attack
+    if (!valid_connection_id(id, addr)) {
+        return;
+    }
+    if (action == UDP_ANNOUNCE) {
+        handle_announce(packet, size, addr, transaction_id);
+    } else if (action == UDP_SCRAPE) {
+        handle_scrape(packet, size, transaction_id);
+    } else {
+        stats.client_error++;
+        error_reply(transaction_id, "Invalid action");
+    }
+}
+
+void udp_tracker::handle_announce(const unsigned char * packet, size_t size, const sockaddr_storage &addr, uint32_t transaction_id) {
+    if (size < 98) {
+        stats.client_error++;
+        error_reply(transaction_id, "Malformed announce");
+        return;
+    }
+    infohash_t info_hash;
+    memcpy(info_hash.data(), packet + 16, info_hash.size());
+
+    announce_request req;
+    memcpy(req.peer_id.data(), packet + 36, req.peer_id.size());
+    req.downloaded = std::max(static_cast<int64_t>(read64(packet + 56)), static_cast<int64_t>(0));
+    req.left = std::max(static_cast<int64_t>(read64(packet + 64)), static_cast<int64_t>(0));
+    req.uploaded = std::max(static_cast<int64_t>(read64(packet + 72)), static_cast<int64_t>(0));
+    req.corrupt = 0;
+    switch (read32(packet + 80)) {
+        case 1:
+            req.event = EVENT_COMPLETED;
+            break;
+        case 2:
+            req.event = EVENT_STARTED;
+            break;
+        case 3:
+            req.event = EVENT_STOPPED;
+            break;
+        default:
+            req.event = EVENT_NONE;
+            break;
+    }
+    req.numwant = static_cast<int32_t>(read32(packet + 92));
+    req.port = (packet[96] << 8) | packet[97];
+
+    // The address field works like the ip parameter of HTTP announces
+    ip_address ip;
+    ip_from_sockaddr(addr, ip);
+    bool ipv6_client = ip.family == IP_V6;
+    if (read32(packet + 84) != 0) {
+        ip_from_binary(packet + 84, false, ip);
+    }
+
+    // Collect the BEP 41 URL data, which holds /<passkey>/announce
+    std::string url_data;
+    for (size_t pos = 98; pos < size;) {
+        unsigned char option = packet[pos];
+        if (option == 0) {
+            break;
+        } else if (option == 1) {
+            pos++;
+        } else {
+            if (pos + 1 >= size || pos + 2 + packet[pos + 1] > size) {
+                break;
+            }
+            if (option == 2) {
+                url_data.append(reinterpret_cast<const char *>(packet + pos + 2), packet[pos + 1]);
+            }
+            pos += 2 + packet[pos + 1];
+        }
+    }
+    std::string passkey;
+    if (url_data.size() >= 33 && url_data[0] == '/') {
+        passkey = url_data.substr(1, 32);
+    }
+
+    announce_result result;
+    const std::string err = work->udp_announce(passkey, info_hash, req, ip, result);
+    if (!err.empty()) {
+        error_reply(transaction_id, err);
+        return;
+    }
+    append32(reply, UDP_ANNOUNCE);
+    append32(reply, transaction_id);
+    append32(reply, result.interval);
+    append32(reply, result.leechers);
+    append32(reply, result.seeders);
+    // Clients get peers of the address family they asked over
+    reply.append(ipv6_client ? result.peers6 : result.peers);
+}
+
+void udp_tracker::handle_scrape(const unsigned char * packet, size_t size, uint32_t transaction_id) {
+    size_t count = std::min((size - 16) / 20, static_cast<size_t>(UDP_MAX_SCRAPE));
+    info_hashes.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        memcpy(info_hashes[i].data(), packet + 16 + i * 20, info_hashes[i].size());
+    }
+    const std::string err = work->udp_scrape(info_hashes, scrape_results);
+    if (!err.empty()) {
+        error_reply(transaction_id, err);
+        return;
+    }
+
+    append32(reply, UDP_SCRAPE);
+    append32(reply, transaction_id);
+    for (const scrape_result &r : scrape_results) {
+        append32(reply, r.seeders);
+        append32(reply, r.completed);
+        append32(reply, r.leechers);
+    }
+}
+
+void udp_tracker::error_reply(uint32_t transaction_id, const std::string &message) {
+    reply.clear();
+    append32(reply, UDP_ERROR);
+    append32(reply, transaction_id);
+    reply.append(message);
+}
@@ -0,0 +1,54 @@
+#ifndef SRC_UDP_H_
+#define SRC_UDP_H_
+
+// Copyright [2017-2024] Orpheus
+
+#include <netinet/in.h>
+#include <spdlog/spdlog.h>
+
+#include <ev++.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "worker.h"
+
+/*
+THE UDP TRACKER
+    Answers connect, announce and scrape packets as described in BEP 15, one
+    socket per event loop. Connection IDs are not stored anywhere: they are a
+    keyed hash of the client address and the current minute, and are accepted
+    for the minute after that too. The passkey comes from the path of the
+    tracker URL, which clients send in the URL data option of BEP 41
+    (udp://host:port/<passkey>/announce). Decoded announces go straight to
+    the same swarm update the HTTP announces use. Scrape packets have no room
+    for URL data, so without a passkey to check they are refused unless
+    udp_scrape is set.
+*/
+class udp_tracker {
+ private:
+    int sock;
+    ev::io read_event;
+    worker * work;
+    const uint64_t * cookie_key;
+    unsigned int read_budget;
+    std::string reply;
+    std::vector<infohash_t> info_hashes;
+    std::vector<scrape_result> scrape_results;
+    std::shared_ptr<spdlog::logger> logger;
+
+    uint64_t connection_id(const sockaddr_storage &addr, uint64_t minute);
+    bool valid_connection_id(uint64_t id, const sockaddr_storage &addr);
+    void handle_packet(const unsigned char * packet, size_t size, const sockaddr_storage &addr);
+    void handle_announce(const unsigned char * packet, size_t size, const sockaddr_storage &addr, uint32_t transaction_id);
+    void handle_scrape(const unsigned char * packet, size_t size, uint32_t transaction_id);
+    void error_reply(uint32_t transaction_id, const std::string &message);
+
+ public:
+    udp_tracker(int udp_sock, struct ev_loop * loop, worker * worker_obj, const uint64_t * key, unsigned int budget);
+    ~udp_tracker();
+    void handle_read(ev::io &watcher, int events_flags);
+};
+
+#endif  // SRC_UDP_H_
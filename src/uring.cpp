@@ -0,0 +1,383 @@
+// Copyright [2017-2024] Orpheus
+
+#ifdef HAVE_LIBURING
+
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <spdlog/spdlog.h>
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#include "ocelot.h"
+#include "config.h"
+#include "db.h"
+#include "worker.h"
+#include "response.h"
+#include "misc_functions.h"
+#include "proxy_protocol.h"
+#include "events.h"
+#include "uring.h"
+
+#define URING_ENTRIES 4096
+#define URING_BUFFERS 1024  // must be a power of two
+#define URING_BUFFER_GROUP 0
+#define URING_ACCEPTS 16  // accepts kept in flight on each socket
+
+uring_loop::uring_loop(int listen_sock, int unix_sock, worker * worker_obj, connection_mother * mother_obj) :
+    buf_ring(NULL), buffers(NULL), buffer_size(0), listen_socket(listen_sock), unix_socket(unix_sock), lag(0), wheel(static_cast<time_t>(monotonic_time())), work(worker_obj), mother(mother_obj) {
+    logger = spdlog::get("logger");
+    memset(&ring, 0, sizeof(ring));
+}
+
+uring_loop::~uring_loop() {
+    io_uring_queue_exit(&ring);
+    if (buf_ring != NULL) {
+        munmap(buf_ring, URING_BUFFERS * sizeof(struct io_uring_buf));
+    }
+    delete[] buffers;
+}
+
+// Must run on the loop thread, the ring is created for a single submitter
+bool uring_loop::init() {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    int ret = io_uring_queue_init_params(URING_ENTRIES, &ring, &params);
+    if (ret < 0) {
+        // Kernels before 6.1 don't know these flags
+        memset(&params, 0, sizeof(params));
+        ret = io_uring_queue_init_params(URING_ENTRIES, &ring, &params);
+    }
+    if (ret < 0) {
+        logger->error("Could not create io_uring: " + std::string(strerror(-ret)));
+        return false;
+    }
+
+    // Register the provided buffer ring the multishot receives read into
+    size_t ring_size = URING_BUFFERS * sizeof(struct io_uring_buf);
+    void * ring_mem = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (ring_mem == MAP_FAILED) {
+        logger->error("Could not allocate io_uring buffer ring: " + std::string(strerror(errno)));
+        return false;
+    }
+    buf_ring = static_cast<struct io_uring_buf_ring *>(ring_mem);
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uintptr_t>(buf_ring);
+    reg.ring_entries = URING_BUFFERS;
+    reg.bgid = URING_BUFFER_GROUP;
+    ret = io_uring_register_buf_ring(&ring, &reg, 0);
+    if (ret < 0) {
+        logger->error("Could not register io_uring buffer ring: " + std::string(strerror(-ret)));
+        return false;
+    }
+
+    buffer_size = mother->max_read_buffer;
+    buffers = new char[URING_BUFFERS * buffer_size];
+    int mask = io_uring_buf_ring_mask(URING_BUFFERS);
+    for (unsigned int i = 0; i < URING_BUFFERS; i++) {
+        io_uring_buf_ring_add(buf_ring, buffers + i * buffer_size, buffer_size, i, mask, i);
+    }
+    io_uring_buf_ring_advance(buf_ring, URING_BUFFERS);
+    return true;
+}
+
+void uring_loop::run() {
+    if (!init()) {
+        logger->critical("Failed to set up io_uring for Ocelot. Exiting.");
+        exit(1);
+    }
+    // The kernel writes into the slots until the accepts complete, so they never move
+    accept_slots.reset(new accept_slot[2 * URING_ACCEPTS]());
+    for (unsigned int i = 0; i < 2 * URING_ACCEPTS; i++) {
+        accept_slots[i].listen_fd = i < URING_ACCEPTS ? listen_socket : unix_socket;
+        if (accept_slots[i].listen_fd != -1) {
+            arm_accept(i);
+        }
+    }
+
+    while (true) {
+        // Submit everything queued while handling the last batch and wait for more.
+        // The timeout lets us expire idle connections
+        struct io_uring_cqe * cqe;
+        struct __kernel_timespec wait_time;
+        wait_time.tv_sec = 1;
+        wait_time.tv_nsec = 0;
+        int ret = io_uring_submit_and_wait_timeout(&ring, &cqe, 1, &wait_time, NULL);
+        if (ret < 0 && ret != -ETIME && ret != -EINTR) {
+            logger->error("io_uring wait failed: " + std::string(strerror(-ret)));
+        }
+
+        // Accepts are judged by how long the last batch took
+        double batch_start = monotonic_time();
+        unsigned int head;
+        unsigned int count = 0;
+        io_uring_for_each_cqe(&ring, head, cqe) {
+            count++;
+            uint64_t data = io_uring_cqe_get_data64(cqe);
+            unsigned int fd = static_cast<unsigned int>(data >> 8);
+            unsigned int op = static_cast<unsigned int>(data & 0xFF);
+            if (op == OP_ACCEPT) {
+                handle_accept(fd, cqe);  // fd is the accept slot
+                continue;
+            }
+            if (fd >= connections.size() || !connections[fd]) {
+                continue;
+            }
+            if (op == OP_RECV) {
+                handle_recv(connections[fd].get(), cqe);
+            } else if (op == OP_SEND) {
+                handle_send(connections[fd].get(), cqe);
+            }
+        }
+        io_uring_cq_advance(&ring, count);
+        lag = monotonic_time() - batch_start;
+
+        wheel.advance(static_cast<time_t>(monotonic_time()));
+    }
+}
+
+struct io_uring_sqe * uring_loop::get_sqe() {
+    struct io_uring_sqe * sqe = io_uring_get_sqe(&ring);
+    while (sqe == NULL) {
+        // Submission queue is full, flush it early
+        io_uring_submit(&ring);
+        sqe = io_uring_get_sqe(&ring);
+    }
+    return sqe;
+}
+
+void uring_loop::arm_accept(unsigned int slot) {
+    accept_slot &a = accept_slots[slot];
+    a.addr_len = sizeof(a.addr);
+    struct io_uring_sqe * sqe = get_sqe();
+    io_uring_prep_accept(sqe, a.listen_fd, reinterpret_cast<sockaddr *>(&a.addr), &a.addr_len, SOCK_CLOEXEC);
+    io_uring_sqe_set_data64(sqe, OP_ACCEPT | (static_cast<uint64_t>(slot) << 8));
+}
+
+void uring_loop::arm_recv(connection * c) {
+    struct io_uring_sqe * sqe = get_sqe();
+    io_uring_prep_recv_multishot(sqe, c->fd, NULL, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    io_uring_sqe_set_data64(sqe, OP_RECV | (static_cast<uint64_t>(c->fd) << 8));
+    c->recv_armed = true;
+    c->recv_cancelled = false;
+}
+
+// The recv completes with -ECANCELED once the kernel has stopped it
+void uring_loop::cancel_recv(connection * c) {
+    struct io_uring_sqe * sqe = get_sqe();
+    io_uring_prep_cancel64(sqe, OP_RECV | (static_cast<uint64_t>(c->fd) << 8), 0);
+    io_uring_sqe_set_data64(sqe, OP_CANCEL | (static_cast<uint64_t>(c->fd) << 8));
+    c->recv_cancelled = true;
+}
+
+void uring_loop::queue_send(connection * c) {
+    struct io_uring_sqe * sqe = get_sqe();
+    memset(&c->msg, 0, sizeof(c->msg));
+    c->msg.msg_iov = c->iov;
+    c->msg.msg_iovlen = c->responses.get_iovec(c->iov);
+    io_uring_prep_sendmsg(sqe, c->fd, &c->msg, MSG_NOSIGNAL);
+    io_uring_sqe_set_data64(sqe, OP_SEND | (static_cast<uint64_t>(c->fd) << 8));
+    c->send_pending = true;
+}
+
+void uring_loop::handle_accept(unsigned int slot, struct io_uring_cqe * cqe) {
+    // Take the client address out of the slot before it is handed back to the kernel.
+    // Unix socket clients have no address, the proxy has to tell us
+    ip_address client_ip;
+    ip_from_sockaddr(accept_slots[slot].addr, client_ip);
+    arm_accept(slot);
+    int fd = cqe->res;
+    if (fd < 0) {
+        logger->error("Accept failed, errno " + std::to_string(-fd) + ": " + std::string(strerror(-fd)));
+        return;
+    }
+
+    // The accepts are armed again right away and drain the backlog, so turn connections away instead
+    if (!mother->open_connection(lag)) {
+        mother->shed_connection(fd);
+        return;
+    }
+
+    connection * c = new connection();
+    c->loop = this;
+    c->fd = fd;
+    c->recv_armed = false;
+    c->recv_cancelled = false;
+    c->send_pending = false;
+    c->closing = false;
+    c->close_after = false;
+    c->client_opts.proxy_protocol = c->proxy_header_pending = mother->proxy_protocol;
+    c->ip = client_ip;
+    wheel.arm(c, mother->connection_timeout);
+
+    if (connections.size() <= static_cast<size_t>(fd)) {
+        connections.resize(fd + 1);
+    }
+    connections[fd].reset(c);
+    arm_recv(c);
+}
+
+void uring_loop::handle_recv(connection * c, struct io_uring_cqe * cqe) {
+    int ret = cqe->res;
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        c->recv_armed = false;
+    }
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        unsigned int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        char * buffer = buffers + bid * buffer_size;
+        if (ret > 0 && !c->closing) {
+            stats.bytes_read += ret;
+            c->request.append(buffer, ret);
+        }
+        // Give the buffer back to the kernel
+        io_uring_buf_ring_add(buf_ring, buffer, buffer_size, bid, io_uring_buf_ring_mask(URING_BUFFERS), 0);
+        io_uring_buf_ring_advance(buf_ring, 1);
+    }
+
+    if (c->closing) {
+        close_connection(c);
+        return;
+    }
+    if (ret == -ENOBUFS || ret == -ECANCELED) {
+        // Every buffer was in use, try again once some have been returned. A
+        // recv we cancelled is armed again once the send is done
+        if (!c->recv_armed && !c->send_pending) {
+            arm_recv(c);
+        }
+        return;
+    }
+    if (ret <= 0) {
+        close_connection(c);
+        return;
+    }
+    if (c->send_pending) {
+        // The requests wait for the send. Stop reading if the client keeps
+        // sending anyway, handle_send arms the recv again
+        if (c->recv_armed && !c->recv_cancelled && c->request.size() > mother->max_request_size) {
+            cancel_recv(c);
+        }
+        return;
+    }
+    if (!c->recv_armed) {
+        arm_recv(c);
+    }
+    handle_requests(c);
+}
+
+void uring_loop::handle_send(connection * c, struct io_uring_cqe * cqe) {
+    c->send_pending = false;
+    int ret = cqe->res;
+    if (c->closing || (ret < 0 && ret != -EAGAIN)) {
+        close_connection(c);
+        return;
+    }
+    if (ret > 0) {
+        stats.bytes_written += ret;
+        c->responses.consume(ret);
+    }
+    if (!c->responses.empty()) {
+        queue_send(c);
+        return;
+    }
+    if (c->close_after) {
+        close_connection(c);
+        return;
+    }
+    wheel.arm(c, mother->keepalive_timeout);
+    if (!c->recv_armed) {
+        arm_recv(c);
+    }
+
+    // More requests may have arrived while we were sending
+    handle_requests(c);
+}
+
+// Answer every complete request in the buffer. Requests have no body, so
+// each one ends with the first blank line. The parser remembers how far it
+// got, so bytes already looked at are not scanned again
+void uring_loop::handle_requests(connection * c) {
+    std::string &input = c->request;
+    size_t pos = 0;
+    if (c->proxy_header_pending) {
+        size_t header_size;
+        switch (parse_proxy_header(input.data(), input.size(), mother->max_request_size, header_size, c->ip)) {
+            case PROXY_HEADER_INVALID:
+                close_connection(c);
+                return;
+            case PROXY_HEADER_INCOMPLETE:
+                return;
+            case PROXY_HEADER_DONE:
+                c->proxy_header_pending = false;
+                pos = header_size;
+                break;
+        }
+    }
+    while (!c->close_after) {
+        std::string_view rest = std::string_view(input).substr(pos);
+        if (!c->parser.feed(rest)) {
+            break;
+        }
+        handle_request(c, rest.substr(0, c->parser.size()));
+        pos += c->parser.size();
+        c->parser.reset();
+    }
+    if (!c->close_after && input.size() - pos > mother->max_request_size) {
+        handle_request(c, std::string_view(input).substr(pos));
+    }
+    if (c->close_after) {
+        input.clear();
+    } else {
+        input.erase(0, pos);
+    }
+
+    if (!c->responses.empty()) {
+        queue_send(c);
+    }
+}
+
+void uring_loop::handle_request(connection * c, std::string_view input) {
+    stats.requests++;
+    c->client_opts.gzip = false;
+    c->client_opts.html = false;
+    c->client_opts.http_close = true;
+
+    if (input.size() > mother->max_request_size) {
+        c->responses.push(error("GET string too long", c->client_opts));
+    } else {
+        // The worker may replace the address with one given by the client
+        ip_address client_ip = c->ip;
+
+        request_t req;
+        request_status req_status = c->parser.finish(input, req);
+
+        //--- CALL WORKER
+        c->responses.push(work->work(req, req_status, client_ip, c->client_opts));
+    }
+    c->close_after = c->client_opts.http_close;
+}
+
+void uring_loop::close_connection(connection * c) {
+    if (c->recv_armed || c->send_pending) {
+        // Shutting the socket down ends the multishot recv, we free the connection
+        // once the kernel is done with it
+        if (!c->closing) {
+            c->closing = true;
+            shutdown(c->fd, SHUT_RDWR);
+        }
+        return;
+    }
+    int fd = c->fd;
+    close(fd);
+    stats.open_connections--;
+    connections[fd].reset();
+}
+
+#endif  // HAVE_LIBURING
@@ -0,0 +1,104 @@
+#ifndef SRC_URING_H_
+#define SRC_URING_H_
+
+// Copyright [2017-2024] Orpheus
+
+#ifdef HAVE_LIBURING
+
+#include <liburing.h>
+#include <sys/socket.h>
+#include <spdlog/spdlog.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ocelot.h"
+#include "response.h"
+#include "timer_wheel.h"
+
+class worker;
+class connection_mother;
+
+/*
+THE URING LOOP
+    An alternative to the libev middlemen, selected with io_backend = io_uring.
+    Each loop owns one listen socket and runs on its own thread. It keeps
+    URING_ACCEPTS accepts in flight on the listen socket and the shared unix
+    socket, each with its own address buffer so the kernel hands us the
+    client address with the connection, and a multishot recv on every
+    connection, which reads into a ring of provided buffers shared by all
+    connections of the loop. Sends are queued while completions are handled
+    and submitted together with the next wait. Requests that arrive while a
+    send is pending wait for it, and a connection that piles up more than
+    max_request_size bytes that way has its recv cancelled until the send
+    completes, like the libev middlemen stop reading. Timeouts are kept on a
+    timer wheel that is advanced after every wait.
+*/
+class uring_loop {
+ private:
+    struct connection : public timer_node {
+        uring_loop * loop;
+        int fd;
+        bool recv_armed;
+        bool recv_cancelled;  // a cancel of the recv is on its way
+        bool send_pending;
+        bool closing;
+        bool close_after;  // close once the queued responses are sent
+        bool proxy_header_pending;
+        client_opts_t client_opts;
+        ip_address ip;
+        std::string request;
+        request_parser parser;  // how far the current request has been read
+        response_queue responses;
+        struct iovec iov[RESPONSE_QUEUE_IOV];  // must stay valid until the send completes
+        struct msghdr msg;
+
+        void expire() { loop->close_connection(this); }
+    };
+
+    enum op_type { OP_ACCEPT = 1, OP_RECV, OP_SEND, OP_CANCEL };
+
+    // Where one pending accept puts the address of its client
+    struct accept_slot {
+        int listen_fd;
+        sockaddr_storage addr;
+        socklen_t addr_len;
+    };
+
+    struct io_uring ring;
+    struct io_uring_buf_ring * buf_ring;
+    char * buffers;
+    unsigned int buffer_size;
+    int listen_socket;
+    int unix_socket;
+    std::unique_ptr<accept_slot[]> accept_slots;  // URING_ACCEPTS for each socket we accept on
+    double lag;  // seconds the last batch of completions took
+    std::vector<std::unique_ptr<connection>> connections;  // indexed by fd
+    timer_wheel wheel;
+    worker * work;
+    connection_mother * mother;
+    std::shared_ptr<spdlog::logger> logger;
+
+    bool init();
+    struct io_uring_sqe * get_sqe();
+    void arm_accept(unsigned int slot);
+    void arm_recv(connection * c);
+    void cancel_recv(connection * c);
+    void queue_send(connection * c);
+    void handle_accept(unsigned int slot, struct io_uring_cqe * cqe);
+    void handle_recv(connection * c, struct io_uring_cqe * cqe);
+    void handle_send(connection * c, struct io_uring_cqe * cqe);
+    void handle_requests(connection * c);
+    void handle_request(connection * c, std::string_view input);
+    void close_connection(connection * c);
+
+ public:
+    uring_loop(int listen_sock, int unix_sock, worker * worker_obj, connection_mother * mother_obj);
+    ~uring_loop();
+    void run();
+};
+
+#endif  // HAVE_LIBURING
+
+#endif  // SRC_URING_H_
@@ -19,6 +19,9 @@
 #include "db.h"
 #include "worker.h"
 #include "misc_functions.h"
+#include "record.h"
+#include "request.h"
+#include "announce_keys.h"
 #include "site_comm.h"
 #include "response.h"
 #include "report.h"
@@ -39,6 +42,7 @@ void worker::load_config(config * conf) {
     peers_timeout       = conf->get_uint("peers_timeout");
     numwant_limit       = conf->get_uint("numwant_limit");
     keepalive_enabled   = conf->get_uint("keepalive_timeout") != 0;
+    udp_scrape_enabled  = conf->get_bool("udp_scrape");
     site_password       = conf->get_str("site_password");
     report_password     = conf->get_str("report_password");
     jitter              = std::uniform_int_distribution<int>(0, conf->get_uint("announce_jitter"));
@@ -69,8 +73,86 @@ bool worker::shutdown() {
     }
 }
 
-std::string worker::work(const std::string &input, std::string &ip, client_opts_t &client_opts) {
-    unsigned int input_length = input.length();
+// Convert the parameters the tracker knows into their fields as they come, the last one of a key wins.
+// Everything else in the query is ignored
+static void decode_announce(const request_t &http_req, http_announce &params) {
+    announce_request &req = params.req;
+    req.left = 0;
+    req.uploaded = 0;
+    req.downloaded = 0;
+    req.corrupt = 0;
+    req.event = EVENT_NONE;
+    req.port = 0;
+    req.numwant = -1;
+    params.compact = false;
+    params.has_info_hash = false;
+    params.has_peer_id = false;
+    params.valid_peer_id = false;
+    params.has_ip = false;
+    params.has_ipv4 = false;
+
+    for (size_t i = 0; i < http_req.param_count; i++) {
+        const request_param &param = http_req.param_at(i);
+        std::string_view value = param.value;
+        switch (find_announce_key(param.key)) {
+            case KEY_INFO_HASH:
+                // info_hash is a url encoded (hex) base 20 number
+                params.has_info_hash = percent_decode(value, params.info_hash);
+                break;
+            case KEY_PEER_ID:
+                params.valid_peer_id = percent_decode(value, req.peer_id);
+                params.has_peer_id = true;
+                break;
+            case KEY_PORT:
+                req.port = strtoint32(value) & 0xFFFF;
+                break;
+            case KEY_UPLOADED:
+                req.uploaded = std::max((int64_t)0, strtoint64(value));
+                break;
+            case KEY_DOWNLOADED:
+                req.downloaded = std::max((int64_t)0, strtoint64(value));
+                break;
+            case KEY_LEFT:
+                req.left = std::max((int64_t)0, strtoint64(value));
+                break;
+            case KEY_CORRUPT:
+                req.corrupt = std::max((int64_t)0, strtoint64(value));
+                break;
+            case KEY_EVENT:
+                if (value == "completed") {
+                    req.event = EVENT_COMPLETED;
+                } else if (value == "started") {
+                    req.event = EVENT_STARTED;
+                } else if (value == "stopped") {
+                    req.event = EVENT_STOPPED;
+                } else {
+                    req.event = EVENT_NONE;
+                }
+                break;
+            case KEY_NUMWANT:
+                req.numwant = strtoint32(value);
+                break;
+            case KEY_COMPACT:
+                params.compact = value == "1";
+                break;
+            case KEY_IP:
+                params.ip = value;
+                params.has_ip = true;
+                break;
+            case KEY_IPV4:
+                params.ipv4 = value;
+                params.has_ipv4 = true;
+                break;
+            default:
+                break;
+        }
+    }
+    req.user_agent = http_req.user_agent;
+}
+
+// Answer a request the connection has parsed, req_status says how that went
+response_t worker::work(const request_t &req, request_status req_status, ip_address &ip, client_opts_t &client_opts) {
+    unsigned int input_length = req.size;
     {
         const std::lock_guard<std::mutex> lock(worker::client_len_mutex);
         unsigned int max_len = stats.max_client_request_len;
@@ -79,143 +161,38 @@ std::string worker::work(const std::string &input, std::string &ip, client_opts_
         }
     }
 
-    //---------- Parse request - ugly but fast. Using substr exploded.
-    if (input_length < 60) {  // Way too short to be anything useful
-        stats.http_error++;
-        return error("GET string too short", client_opts);
-    }
-
-    size_t pos = 5;  // skip 'GET /'
-
-    // Get the passkey
-    std::string passkey;
-    passkey.reserve(32);
-    if (input[37] != '/') {
-        stats.http_error++;
-        return error("Malformed announce", client_opts);
+    if (req.action == ACTION_ANNOUNCE) {
+        stats.announcements++;
+    } else if (req.action == ACTION_SCRAPE) {
+        stats.scrapes++;
     }
-
-    for (; pos < 37; pos++) {
-        passkey.push_back(input[pos]);
-    }
-
-    pos = 38;
-
-    // Get the action
-    enum action_t {
-        INVALID = 0, ANNOUNCE, SCRAPE, UPDATE, REPORT
-    };
-    action_t action = INVALID;
-
-    switch (input[pos]) {
-        case 'a':
-            stats.announcements++;
-            action = ANNOUNCE;
-            pos += 8;
-            break;
-        case 's':
-            stats.scrapes++;
-            action = SCRAPE;
-            pos += 6;
+    switch (req_status) {
+        case REQUEST_OK:
             break;
-        case 'u':
-            action = UPDATE;
-            pos += 6;
-            break;
-        case 'r':
-            action = REPORT;
-            pos += 6;
-            break;
-    }
-
-    if (input[pos] != '?') {
-        // No parameters given. Probably means we're not talking to a torrent client
-        client_opts.html = true;
-        return http_response("Nothing to see here", client_opts);
-    }
-
-    // Parse URL params
-    std::list<std::string> infohashes;  // For scrape only
-
-    params_type params;
-    std::string key;
-    std::string value;
-    bool parsing_key = true;  // true = key, false = value
-
-    ++pos;  // Skip the '?'
-    for (; pos < input_length; ++pos) {
-        if (input[pos] == '=') {
-            parsing_key = false;
-        } else if (input[pos] == '&' || input[pos] == ' ') {
-            parsing_key = true;
-            if (action == SCRAPE && key == "info_hash") {
-                infohashes.push_back(value);
-            } else {
-                params[key] = value;
-            }
-            key.clear();
-            value.clear();
-            if (input[pos] == ' ') {
-                break;
-            }
-        } else {
-            if (parsing_key) {
-                key.push_back(input[pos]);
-            } else {
-                value.push_back(input[pos]);
-            }
-        }
-    }
-    ++pos;
-
-    if (input.compare(pos, 5, "HTTP/") != 0) {
-        stats.http_error++;
-        return error("Malformed HTTP request", client_opts);
-    }
-
-    std::string http_version;
-    pos += 5;
-    while (input[pos] != '\r' && input[pos] != '\n') {
-        http_version.push_back(input[pos]);
-        ++pos;
-    }
-    ++pos;  // skip line break - should probably be += 2, but just in case a client doesn't send \r
-
-    // Parse headers
-    params_type headers;
-    parsing_key = true;
-    bool found_data = false;
-
-    for (; pos < input_length; ++pos) {
-        if (input[pos] == ':') {
-            parsing_key = false;
-            ++pos;  // skip space after :
-        } else if (input[pos] == '\n' || input[pos] == '\r') {
-            parsing_key = true;
-
-            if (found_data) {
-                found_data = false;  // dodge for getting around \r\n or just \n
-                std::transform(key.begin(), key.end(), key.begin(), ::tolower);
-                headers[key] = value;
-                key.clear();
-                value.clear();
-            }
-        } else {
-            found_data = true;
-            if (parsing_key) {
-                key.push_back(input[pos]);
-            } else {
-                value.push_back(input[pos]);
-            }
-        }
+        case REQUEST_TOO_SHORT:
+            stats.http_error++;
+            return error("GET string too short", client_opts);
+        case REQUEST_MALFORMED:
+            stats.http_error++;
+            return error("Malformed announce", client_opts);
+        case REQUEST_NO_PARAMS:
+            // No parameters given. Probably means we're not talking to a torrent client
+            client_opts.html = true;
+            return http_response("Nothing to see here", client_opts);
+        case REQUEST_TOO_MANY_PARAMS:
+            stats.http_error++;
+            return error("Too many parameters", client_opts);
+        case REQUEST_BAD_HTTP:
+            stats.http_error++;
+            return error("Malformed HTTP request", client_opts);
     }
 
     if (keepalive_enabled) {
-        auto hdr_http_close = headers.find("connection");
-        if (hdr_http_close == headers.end()) {
-            client_opts.http_close = (http_version == "1.0");
+        std::string_view connection = req.connection;
+        if (connection.empty()) {
+            client_opts.http_close = (req.http_version == "1.0");
         } else {
-            client_opts.http_close = (hdr_http_close->second != "Keep-Alive");
+            client_opts.http_close = (connection != "Keep-Alive");
         }
     } else {
         client_opts.http_close = true;
@@ -223,24 +200,30 @@ std::string worker::work(const std::string &input, std::string &ip, client_opts_
 
     if (status != OPEN) {
         return error("The tracker is temporarily unavailable.", client_opts);
-    } else if (action == INVALID) {
+    } else if (req.action == ACTION_INVALID) {
         stats.http_error++;
         return error("Invalid action", client_opts);
-    } else if (action == UPDATE) {
-        if (passkey != site_password) {
+    } else if (req.action == ACTION_UPDATE) {
+        if (req.passkey != site_password) {
             stats.auth_error_secret++;
             logger->error("incorrect TRACKER_SECRET received");
             return error("Authentication failure", client_opts);
         }
+        // Updates come from the site and are rare, they keep the convenience of a map
+        params_type params;
+        for (size_t i = 0; i < req.param_count; i++) {
+            const request_param &param = req.param_at(i);
+            params[std::string(param.key)] = std::string(param.value);
+        }
         return update(params, client_opts);
-    } else if (action == REPORT) {
-        if (passkey != report_password) {
+    } else if (req.action == ACTION_REPORT) {
+        if (req.passkey != report_password) {
             stats.auth_error_report++;
             logger->error("incorrect TRACKER_REPORT received");
             return error("Authentication failure", client_opts);
         }
 
-        std::string report_action(params["get"]);
+        std::string_view report_action = req.param("get");
         if (report_action == "prom_stats") {
             // exclude per-arena (a), destroyed merged (d), mutex (m) and extents (e) statistics
             std::string jemalloc_stats(report_jemalloc_plain("adex", conf->get_str("report_path")));
@@ -259,7 +242,7 @@ std::string worker::work(const std::string &input, std::string &ip, client_opts_
                 client_opts
             );
         } else if (report_action == "user") {
-            std::string announce_key = params["key"];
+            std::string_view announce_key = req.param("key");
             if (announce_key.empty()) {
                 stats.auth_error_announce_key++;
                 logger->error("user report with no announce key");
@@ -293,7 +276,7 @@ std::string worker::work(const std::string &input, std::string &ip, client_opts_
     {
         // lock scope
         std::lock_guard<std::mutex> ul_lock(db->user_list_mutex);
-        auto user_it = users_list.find(passkey);
+        auto user_it = users_list.find(req.passkey);
         if (user_it == users_list.end()) {
             stats.auth_error_announce_key++;
             return error("Passkey not found", client_opts);
@@ -301,74 +284,146 @@ std::string worker::work(const std::string &input, std::string &ip, client_opts_
         u = user_it->second;
     }
 
-    if (action == SCRAPE) {
-        return scrape(infohashes, headers, client_opts);
+    if (req.action == ACTION_SCRAPE) {
+        return scrape(req, client_opts);
     }
 
-    // Let's translate the infohash into something nice
-    // info_hash is a url encoded (hex) base 20 number
-    std::string info_hash_decoded = hex_decode(params["info_hash"]);
+    http_announce params;
+    decode_announce(req, params);
+    if (!params.has_info_hash) {
+        return error("Unregistered torrent", client_opts);
+    }
     std::lock_guard<std::mutex> tl_lock(db->torrent_list_mutex);
-    auto tor = torrents_list.find(info_hash_decoded);
+    auto tor = torrents_list.find(params.info_hash);
     if (tor == torrents_list.end()) {
-        std::lock_guard<std::mutex> dr_lock(del_reasons_lock);
-        auto msg = del_reasons.find(info_hash_decoded);
-        if (msg != del_reasons.end()) {
-            if (msg->second.reason != -1) {
-                return error("Unregistered torrent: " + get_del_reason(msg->second.reason), client_opts);
-            } else {
-                return error("Unregistered torrent", client_opts);
-            }
-        } else {
-            return error("Unregistered torrent", client_opts);
-        }
+        return error(unregistered_torrent(params.info_hash), client_opts);
+    }
+    return announce(params, req, tor->second, u, ip, client_opts);
+}
+
+// Tell the client why a torrent is gone, if we know
+std::string worker::unregistered_torrent(const infohash_t &info_hash) {
+    std::lock_guard<std::mutex> dr_lock(del_reasons_lock);
+    auto msg = del_reasons.find(info_hash);
+    if (msg != del_reasons.end() && msg->second.reason != -1) {
+        return "Unregistered torrent: " + get_del_reason(msg->second.reason);
     }
-    return announce(input, tor->second, u, params, headers, ip, client_opts);
+    return "Unregistered torrent";
 }
 
 const std::string bencode_warning(const std::string &message) {
     return "15:warning message" + inttostr(message.length()) + ':' + message;
 }
 
-std::string worker::announce(const std::string &input, torrent &tor, user_ptr &u, params_type &params, params_type &headers, std::string &ip, client_opts_t &client_opts) {
-    cur_time = time(NULL);
-
-    if (params["compact"] != "1") {
+response_t worker::announce(const http_announce &params, const request_t &http_req, torrent &tor, user_ptr &u, ip_address &ip, client_opts_t &client_opts) {
+    if (!params.compact) {
         stats.client_error++;
         return error("Your client does not support compact announces", client_opts);
     }
 
-    params_type::const_iterator peer_id_iterator = params.find("peer_id");
-    if (peer_id_iterator == params.end()) {
+    if (!params.has_peer_id) {
         stats.client_error++;
         return error("No peer ID", client_opts);
     }
-    const std::string peer_id = hex_decode(peer_id_iterator->second);
-    if (peer_id.length() != 20) {
+    if (!params.valid_peer_id) {
         stats.client_error++;
         return error("Invalid peer ID", client_opts);
     }
+    const announce_request &req = params.req;
+
+    // Addresses given as text leave ip unusable if they don't parse
+    if (params.has_ip) {
+        parse_ip(params.ip, ip);
+    } else if (params.has_ipv4) {
+        parse_ip(params.ipv4, ip);
+    } else if (!client_opts.proxy_protocol) {
+        std::string_view forwarded_for = http_req.forwarded_for;
+        if (!forwarded_for.empty()) {
+            parse_ip(forwarded_for.substr(0, forwarded_for.find(',')), ip);
+        }
+    }
+
+    announce_result result;
+    const std::string err = announce_peer(tor, u, req, ip, result);
+    if (!err.empty()) {
+        return error(err, client_opts);
+    }
+
+    std::string output = "d8:completei";
+    output.reserve(350);
+    append_int(output, result.seeders);
+    output += "e10:downloadedi";
+    append_int(output, result.completed);
+    output += "e10:incompletei";
+    append_int(output, result.leechers);
+    output += "e8:intervali";
+    append_int(output, result.interval);
+    output += "e12:min intervali";
+    append_int(output, announce_interval);
+    output += "e5:peers";
+    if (result.peers.length() == 0) {
+        output += "0:";
+    } else {
+        append_int(output, result.peers.length());
+        output += ":";
+        output += result.peers;
+    }
+    if (result.peers6.length() != 0) {
+        output += "6:peers6";
+        append_int(output, result.peers6.length());
+        output += ":";
+        output += result.peers6;
+    }
+    if (result.invalid_ip) {
+        output += bencode_warning("Invalid IP address");
+    }
+    output += 'e';
+
+    /* gzip compression actually makes announce returns larger from our
+     * testing. Feel free to enable this here if you'd like but be aware of
+     * possibly inflated return size
+     */
+    /*if (http_req.accept_encoding.find("gzip") != std::string_view::npos) {
+        client_opts.gzip = true;
+    }*/
+    return http_response(std::move(output), client_opts);
+}
+
+// Add a peer in the compact format of BEP 23, or of BEP 7 for IPv6 peers
+static inline void append_peer(announce_result &result, const peer &p) {
+    std::string &out = p.ip.family == IP_V6 ? result.peers6 : result.peers;
+    out.append(reinterpret_cast<const char *>(p.ip.bytes), p.ip.size());
+    out.push_back(p.port >> 8);
+    out.push_back(p.port & 0xFF);
+}
+
+// Update the swarm with an announce from any protocol. Returns an error message, or an empty string on success
+std::string worker::announce_peer(torrent &tor, user_ptr &u, const announce_request &req, const ip_address &ip, announce_result &result) {
+    cur_time = time(NULL);
+
+    const peerid_t &peer_id = req.peer_id;
 
     std::unique_lock<std::mutex> wl_lock(db->whitelist_mutex);
     if (whitelist.size() > 0) {
         bool found = false;  // Found client in whitelist?
         for (unsigned int i = 0; i < whitelist.size(); i++) {
-            if (peer_id.compare(0, whitelist[i].length(), whitelist[i]) == 0) {
+            const std::string &prefix = whitelist[i];
+            if (prefix.length() <= peer_id.size() && memcmp(peer_id.data(), prefix.data(), prefix.length()) == 0) {
                 found = true;
                 break;
             }
         }
         if (!found) {
             stats.client_error++;
-            return error("Your client is not on the whitelist", client_opts);
+            return "Your client is not on the whitelist";
         }
     }
     wl_lock.unlock();
 
-    int64_t left = std::max((int64_t)0, strtoint64(params["left"]));
-    int64_t uploaded = std::max((int64_t)0, strtoint64(params["uploaded"]));
-    int64_t downloaded = std::max((int64_t)0, strtoint64(params["downloaded"]));
-    int64_t corrupt = std::max((int64_t)0, strtoint64(params["corrupt"]));
+    int64_t left = req.left;
+    int64_t uploaded = req.uploaded;
+    int64_t downloaded = req.downloaded;
+    int64_t corrupt = req.corrupt;
 
     int snatched = 0;                // This is the value that gets sent to the database on a snatch
     int active = 1;                  // This is the value that marks a peer as active/inactive in the database
@@ -382,80 +437,85 @@ std::string worker::announce(const std::string &input, torrent &tor, user_ptr &u
     bool inc_l = false, inc_s = false, dec_l = false, dec_s = false;
     userid_t userid = u->get_id();
 
-    // "Randomize" the element order in the peer map by prefixing with a peer id byte
-    std::stringstream peer_key_stream;
-    peer_key_stream << peer_id[12 + (tor.id & 7)]
-        << userid  // Include user id in the key to lower chance of peer id collisions
-        << peer_id;
-    const std::string peer_key(peer_key_stream.str());
+    // Include user id in the key to lower chance of peer id collisions
+    peer_key_t peer_key;
+    peer_key[0] = static_cast<uint8_t>(userid >> 24);
+    peer_key[1] = static_cast<uint8_t>(userid >> 16);
+    peer_key[2] = static_cast<uint8_t>(userid >> 8);
+    peer_key[3] = static_cast<uint8_t>(userid);
+    memcpy(peer_key.data() + 4, peer_id.data(), peer_id.size());
 
-    if (params["event"] == "completed") {
+    if (req.event == EVENT_COMPLETED) {
         // Don't update <snatched> here as we may decide to use other conditions later on
         completed_torrent = (left == 0);  // Sanity check just to be extra safe
-    } else if (params["event"] == "stopped") {
+    } else if (req.event == EVENT_STOPPED) {
         stopped_torrent = true;
         peer_changed = true;
         update_torrent = true;
         active = 0;
     }
     peer * p;
-    peer_list::iterator peer_it;
+    size_t peer_slot;  // The peer's place in its list. Only good until the list changes
     // Insert/find the peer in the torrent list
     if (left > 0) {
-        peer_it = tor.leechers.find(peer_key);
-        if (peer_it == tor.leechers.end()) {
+        peer_slot = tor.leechers.find(peer_key);
+        if (peer_slot == peer_list::npos) {
             // We could search the seed list as well, but the peer reaper will sort things out eventually
-            peer_it = add_peer(tor.leechers, peer_key);
+            peer_slot = add_peer(tor.leechers, peer_key);
             inserted = true;
             inc_l = true;
         }
+        p = &tor.leechers.at(peer_slot);
     } else if (completed_torrent) {
-        peer_it = tor.leechers.find(peer_key);
-        if (peer_it == tor.leechers.end()) {
-            peer_it = tor.seeders.find(peer_key);
-            if (peer_it == tor.seeders.end()) {
-                peer_it = add_peer(tor.seeders, peer_key);
+        peer_slot = tor.leechers.find(peer_key);
+        if (peer_slot == peer_list::npos) {
+            peer_slot = tor.seeders.find(peer_key);
+            if (peer_slot == peer_list::npos) {
+                peer_slot = add_peer(tor.seeders, peer_key);
                 inserted = true;
                 inc_s = true;
             } else {
                 completed_torrent = false;
             }
-        } else if (tor.seeders.find(peer_key) != tor.seeders.end()) {
-            // If the peer exists in both peer lists, just decrement the seed count.
-            // Should be cheaper than searching the seed list in the left > 0 case
-            dec_s = true;
+            p = &tor.seeders.at(peer_slot);
+        } else {
+            if (tor.seeders.find(peer_key) != peer_list::npos) {
+                // If the peer exists in both peer lists, just decrement the seed count.
+                // Should be cheaper than searching the seed list in the left > 0 case
+                dec_s = true;
+            }
+            p = &tor.leechers.at(peer_slot);
         }
     } else {
-        peer_it = tor.seeders.find(peer_key);
-        if (peer_it == tor.seeders.end()) {
-            peer_it = tor.leechers.find(peer_key);
-            if (peer_it == tor.leechers.end()) {
-                peer_it = add_peer(tor.seeders, peer_key);
+        peer_slot = tor.seeders.find(peer_key);
+        if (peer_slot == peer_list::npos) {
+            size_t leecher_slot = tor.leechers.find(peer_key);
+            if (leecher_slot == peer_list::npos) {
+                peer_slot = add_peer(tor.seeders, peer_key);
                 inserted = true;
             } else {
-                p = &peer_it->second;
-                std::pair<peer_list::iterator, bool> insert
-                = tor.seeders.insert(std::pair<std::string, peer>(peer_key, *p));
-                tor.leechers.erase(peer_it);
-                peer_it = insert.first;
+                peer_slot = tor.seeders.insert(peer_key, tor.leechers.at(leecher_slot)).first;
+                tor.leechers.erase(leecher_slot);
                 peer_changed = true;
                 dec_l = true;
             }
             inc_s = true;
         }
+        p = &tor.seeders.at(peer_slot);
     }
-    p = &peer_it->second;
 
+    const uint32_t now = peer_time(cur_time);
     int64_t upspeed = 0;
     int64_t downspeed = 0;
-    if (inserted || params["event"] == "started") {
+    if (inserted || req.event == EVENT_STARTED) {
         // New peer on this torrent (maybe)
         update_torrent = true;
         if (inserted) {
             // If this was an existing peer, the user pointer will be corrected later
             p->user = u;
+            p->userid = userid;
         }
-        p->first_announced = cur_time;
+        p->first_announced = now;
         p->last_announced = 0;
         p->uploaded = uploaded;
         p->downloaded = downloaded;
@@ -494,9 +554,9 @@ std::string worker::announce(const std::string &input, torrent &tor, user_ptr &u
             tor.balance -= downloaded_change;
             update_torrent = true;
 
-            if (cur_time > p->last_announced) {
-                upspeed = uploaded_change / (cur_time - p->last_announced);
-                downspeed = downloaded_change / (cur_time - p->last_announced);
+            if (now > p->last_announced) {
+                upspeed = uploaded_change / (now - p->last_announced);
+                downspeed = downloaded_change / (now - p->last_announced);
             }
             auto sit = tor.tokened_users.find(userid);
             if (tor.free_torrent == NEUTRAL) {
@@ -505,102 +565,53 @@ std::string worker::announce(const std::string &input, torrent &tor, user_ptr &u
             } else if (tor.free_torrent == FREE || sit != tor.tokened_users.end()) {
                 if (sit != tor.tokened_users.end()) {
                     expire_token = true;
-                    std::stringstream record;
+                    record_buffer record;
                     record << '(' << userid << ',' << tor.id << ',' << downloaded_change << ')';
-                    std::string record_str = record.str();
-                    db->record_token(record_str);
+                    db->record_token(record.view());
                 }
                 downloaded_change = 0;
             }
 
             if (uploaded_change || downloaded_change) {
-                std::stringstream record;
+                record_buffer record;
                 record << '(' << userid << ',' << uploaded_change << ',' << downloaded_change << ')';
-                std::string record_str = record.str();
-                db->record_user(record_str);
-            }
-        }
-    }
-    p->left = left;
-
-    params_type::const_iterator param_ip = params.find("ip");
-    if (param_ip != params.end()) {
-        ip = param_ip->second;
-    } else if ((param_ip = params.find("ipv4")) != params.end()) {
-        ip = param_ip->second;
-    } else {
-        auto head_itr = headers.find("x-forwarded-for");
-        if (head_itr != headers.end()) {
-            size_t ip_end_pos = head_itr->second.find(',');
-            if (ip_end_pos != std::string::npos) {
-                ip = head_itr->second.substr(0, ip_end_pos);
-            } else {
-                ip = head_itr->second;
+                db->record_user(record.view());
             }
         }
     }
+    p->seeding = left == 0;
 
-    uint16_t port = strtoint32(params["port"]) & 0xFFFF;
-    // Generate compact ip/port string
-    if (inserted || port != p->port || ip != p->ip) {
-        p->port = port;
+    if (inserted || req.port != p->port || ip != p->ip) {
+        p->port = req.port;
         p->ip = ip;
-        p->ip_port = "";
-        char x = 0;
-        for (size_t pos = 0, end = ip.length(); pos < end; pos++) {
-            if (ip[pos] == '.') {
-                p->ip_port.push_back(x);
-                x = 0;
-                continue;
-            } else if (!isdigit(ip[pos])) {
-                invalid_ip = true;
-                break;
-            }
-            x = x * 10 + ip[pos] - '0';
-        }
-        if (!invalid_ip) {
-            p->ip_port.push_back(x);
-            p->ip_port.push_back(port >> 8);
-            p->ip_port.push_back(port & 0xFF);
-        }
-        if (p->ip_port.length() != 6) {
-            p->ip_port.clear();
-            invalid_ip = true;
-        }
-        p->invalid_ip = invalid_ip;
-    } else {
-        invalid_ip = p->invalid_ip;
+        p->invalid_ip = ip.family == IP_NONE;
     }
+    invalid_ip = p->invalid_ip;
 
     // Update the peer
-    p->last_announced = cur_time;
+    p->last_announced = now;
     p->visible = peer_is_visible(u, p);
 
     // Add peer data to the database
-    std::stringstream record;
+    record_buffer record;
     if (peer_changed) {
-        record << '(' << userid << ',' << tor.id << ',' << active << ',' << uploaded << ',' << downloaded << ',' << upspeed << ',' << downspeed << ',' << left << ',' << corrupt << ',' << (cur_time - p->first_announced) << ',' << p->announces << ',';
-        std::string record_str = record.str();
+        record << '(' << userid << ',' << tor.id << ',' << active << ',' << uploaded << ',' << downloaded << ',' << upspeed << ',' << downspeed << ',' << left << ',' << corrupt << ',' << (now - p->first_announced) << ',' << p->announces << ',';
         std::string record_ip;
-        if (u->is_protected()) {
-            record_ip = "";
-        } else {
-            record_ip = ip;
+        if (!u->is_protected()) {
+            record_ip = ip_to_string(ip);
         }
-        db->record_peer(record_str, record_ip, peer_id, headers["user-agent"]);
+        db->record_peer(record.view(), record_ip, binary_view(peer_id), req.user_agent);
     } else {
-        record << '(' << userid << ',' << tor.id << ',' << (cur_time - p->first_announced) << ',' << p->announces << ',';
-        std::string record_str = record.str();
-        db->record_peer(record_str, peer_id);
+        record << '(' << userid << ',' << tor.id << ',' << (now - p->first_announced) << ',' << p->announces << ',';
+        db->record_peer(record.view(), binary_view(peer_id));
     }
 
     // Select peers!
     uint32_t numwant;
-    params_type::const_iterator param_numwant = params.find("numwant");
-    if (param_numwant == params.end()) {
+    if (req.numwant < 0) {
         numwant = numwant_limit;
     } else {
-        numwant = std::min((int32_t)numwant_limit, strtoint32(param_numwant->second));
+        numwant = std::min(numwant_limit, static_cast<uint32_t>(req.numwant));
     }
 
     if (stopped_torrent) {
@@ -615,24 +626,20 @@ std::string worker::announce(const std::string &input, torrent &tor, user_ptr &u
         update_torrent = true;
         tor.completed++;
 
-        std::stringstream record;
+        record_buffer record;
         std::string record_ip;
-        if (u->is_protected()) {
-            record_ip = "";
-        } else {
-            record_ip = ip;
+        if (!u->is_protected()) {
+            record_ip = ip_to_string(ip);
         }
         record << '(' << userid << ',' << tor.id << ',' << cur_time;
-        std::string record_str = record.str();
-        db->record_snatch(record_str, record_ip);
+        db->record_snatch(record.view(), record_ip);
 
         // User is a seeder now!
         if (!inserted) {
-            std::pair<peer_list::iterator, bool> insert
-            = tor.seeders.insert(std::pair<std::string, peer>(peer_key, *p));
-            tor.leechers.erase(peer_it);
-            peer_it = insert.first;
-            p = &peer_it->second;
+            size_t seeder_slot = tor.seeders.insert(peer_key, *p).first;
+            tor.leechers.erase(peer_slot);
+            peer_slot = seeder_slot;
+            p = &tor.seeders.at(peer_slot);
             dec_l = inc_s = true;
         }
         if (expire_token) {
@@ -643,75 +650,59 @@ std::string worker::announce(const std::string &input, torrent &tor, user_ptr &u
         numwant = 0;
     }
 
-    std::string peers;
+    result.peers.clear();
+    result.peers6.clear();
     if (numwant > 0) {
-        peers.reserve(numwant*6);
+        result.peers.reserve(numwant*6);
         unsigned int found_peers = 0;
         if (left > 0) {  // Show seeders to leechers first
-            if (tor.seeders.size() > 0) {
-                // We do this complicated stuff to cycle through the seeder list,
+            const size_t seeders = tor.seeders.size();
+            if (seeders > 0) {
+                // Go around the seeder list from where the last leecher stopped,
                 // so all seeders will get shown to leechers
-
-                // Find out where to begin in the seeder list
-                peer_list::const_iterator i;
-                if (tor.last_selected_seeder.empty()) {
-                    i = tor.seeders.begin();
-                } else {
-                    i = tor.seeders.find(tor.last_selected_seeder);
-                    if (i == tor.seeders.end() || ++i == tor.seeders.end()) {
-                        i = tor.seeders.begin();
-                    }
-                }
-
-                // Find out where to end in the seeder list
-                peer_list::const_iterator end;
-                if (i == tor.seeders.begin()) {
-                    end = tor.seeders.end();
-                } else {
-                    end = i;
-                    if (--end == tor.seeders.begin()) {
-                        ++end;
-                        ++i;
-                    }
-                }
-
-                // Add seeders
-                while (i != end && found_peers < numwant) {
-                    if (i == tor.seeders.end()) {
-                        i = tor.seeders.begin();
-                    }
-                    // Don't show users themselves
-                    if (i->second.user->is_deleted() || i->second.user->get_id() == userid || !i->second.visible) {
-                        ++i;
+                size_t i = tor.next_seeder < seeders ? tor.next_seeder : 0;
+                for (size_t n = 0; n < seeders && found_peers < numwant; n++) {
+                    const peer &seeder = tor.seeders.at(i);
+                    i = i + 1 == seeders ? 0 : i + 1;
+                    // Don't show users themselves. Only look at the user of peers that could be shown
+                    if (seeder.userid == userid || !seeder.visible || seeder.user->is_deleted()) {
                         continue;
                     }
-                    peers.append(i->second.ip_port);
+                    append_peer(result, seeder);
                     found_peers++;
-                    tor.last_selected_seeder = i->first;
-                    ++i;
+                    tor.next_seeder = i;
                 }
             }
 
-            if (found_peers < numwant && tor.leechers.size() > 1) {
-                for (peer_list::const_iterator i = tor.leechers.begin(); i != tor.leechers.end() && found_peers < numwant; ++i) {
+            const size_t leechers = tor.leechers.size();
+            if (found_peers < numwant && leechers > 1) {
+                // The list is in no particular order, start somewhere else every time
+                size_t i = randgen() % leechers;
+                for (size_t n = 0; n < leechers && found_peers < numwant; n++) {
+                    const peer &leecher = tor.leechers.at(i);
+                    i = i + 1 == leechers ? 0 : i + 1;
                     // Don't show users themselves or leech disabled users
-                    if (i->second.user->is_deleted() || i->second.ip_port == p->ip_port || i->second.user->get_id() == userid || !i->second.visible) {
+                    if (leecher.userid == userid || !leecher.visible || (leecher.ip == p->ip && leecher.port == p->port) || leecher.user->is_deleted()) {
                         continue;
                     }
                     found_peers++;
-                    peers.append(i->second.ip_port);
+                    append_peer(result, leecher);
                 }
 
             }
         } else if (tor.leechers.size() > 0) {
             // User is a seeder, and we have leechers!
-            for (peer_list::const_iterator i = tor.leechers.begin(); i != tor.leechers.end() && found_peers < numwant; ++i) {
+            const size_t leechers = tor.leechers.size();
+            size_t i = randgen() % leechers;
+            for (size_t n = 0; n < leechers && found_peers < numwant; n++) {
+                const peer &leecher = tor.leechers.at(i);
+                i = i + 1 == leechers ? 0 : i + 1;
                 // Don't show users themselves or leech disabled users
-                if (i->second.user->get_id() == userid || !i->second.visible) {
+                if (leecher.userid == userid || !leecher.visible) {
                     continue;
                 }
                 found_peers++;
-                peers.append(i->second.ip_port);
+                append_peer(result, leecher);
             }
         }
     }
@@ -749,14 +740,15 @@ std::string worker::announce(const std::string &input, torrent &tor, user_ptr &u
             }
         }
         p->user = u;
+        p->userid = userid;
     }
 
     // Delete peers as late as possible to prevent access problems
     if (stopped_torrent) {
         if (left > 0) {
-            tor.leechers.erase(peer_it);
+            tor.leechers.erase(peer_slot);
         } else {
-            tor.seeders.erase(peer_it);
+            tor.seeders.erase(peer_slot);
         }
     }
 
@@ -764,55 +756,36 @@ std::string worker::announce(const std::string &input, torrent &tor, user_ptr &u
     if (update_torrent || tor.last_flushed + 3600 < cur_time) {
         tor.last_flushed = cur_time;
 
-        std::stringstream record;
+        record_buffer record;
         record << '(' << tor.id << ',' << tor.seeders.size() << ',' << tor.leechers.size() << ',' << snatched << ',' << tor.balance << ')';
-        std::string record_str = record.str();
-        db->record_torrent(record_str);
+        db->record_torrent(record.view());
     }
 
     if (!u->can_leech() && left > 0) {
-        return error("Access denied, leeching forbidden", client_opts);
+        return "Access denied, leeching forbidden";
     }
 
-    std::string output = "d8:completei";
-    output.reserve(350);
-    output += inttostr(tor.seeders.size());
-    output += "e10:downloadedi";
-    output += inttostr(tor.completed);
-    output += "e10:incompletei";
-    output += inttostr(tor.leechers.size());
-    output += "e8:intervali";
-    output += inttostr(announce_interval + jitter(randgen));
-    output += "e12:min intervali";
-    output += inttostr(announce_interval);
-    output += "e5:peers";
-    if (peers.length() == 0) {
-        output += "0:";
-    } else {
-        output += inttostr(peers.length());
-        output += ":";
-        output += peers;
-    }
-    if (invalid_ip) {
-        output += bencode_warning("Illegal character found in IP address. IPv6 is not supported");
-    }
-    output += 'e';
-
-    /* gzip compression actually makes announce returns larger from our
-     * testing. Feel free to enable this here if you'd like but be aware of
-     * possibly inflated return size
-     */
-    /*if (headers["accept-encoding"].find("gzip") != std::string::npos) {
-        client_opts.gzip = true;
-    }*/
-    return http_response(output, client_opts);
+    result.seeders = tor.seeders.size();
+    result.leechers = tor.leechers.size();
+    result.completed = tor.completed;
+    result.interval = announce_interval + jitter(randgen);
+    result.invalid_ip = invalid_ip;
+    return "";
 }
 
-std::string worker::scrape(const std::list<std::string> &infohashes, params_type &headers, client_opts_t &client_opts) {
+response_t worker::scrape(const request_t &params, client_opts_t &client_opts) {
     std::string output = "d5:filesd";
-    for (std::list<std::string>::const_iterator i = infohashes.begin(); i != infohashes.end(); ++i) {
-        std::string infohash = *i;
-        infohash = hex_decode(infohash);
+    std::lock_guard<std::mutex> tl_lock(db->torrent_list_mutex);
+    param_reader reader(params.query);
+    request_param param;
+    while (reader.next(param)) {
+        if (param.key != "info_hash") {
+            continue;
+        }
+        infohash_t infohash;
+        if (!percent_decode(param.value, infohash)) {
+            continue;
+        }
 
         torrent_list::iterator tor = torrents_list.find(infohash);
         if (tor == torrents_list.end()) {
@@ -820,43 +793,112 @@ std::string worker::scrape(const std::list<std::string> &infohashes, params_type
         }
         torrent *t = &(tor->second);
 
-        output += inttostr(infohash.length());
+        append_int(output, infohash.size());
         output += ':';
-        output += infohash;
+        output += binary_view(infohash);
         output += "d8:completei";
-        output += inttostr(t->seeders.size());
+        append_int(output, t->seeders.size());
         output += "e10:incompletei";
-        output += inttostr(t->leechers.size());
+        append_int(output, t->leechers.size());
         output += "e10:downloadedi";
-        output += inttostr(t->completed);
+        append_int(output, t->completed);
         output += "ee";
     }
     output += "ee";
-    if (headers["accept-encoding"].find("gzip") != std::string::npos) {
+    if (params.accept_encoding.find("gzip") != std::string_view::npos) {
         client_opts.gzip = true;
     }
-    return http_response(output, client_opts);
+    return http_response(std::move(output), client_opts);
+}
+
+// Announce from the UDP tracker, which has already decoded the packet.
+// Returns an error message, or an empty string on success
+std::string worker::udp_announce(const std::string &passkey, const infohash_t &info_hash, const announce_request &req, const ip_address &ip, announce_result &result) {
+    stats.announcements++;
+    if (status != OPEN) {
+        return "The tracker is temporarily unavailable.";
+    }
+
+    user_ptr u;
+    {
+        // lock scope
+        std::lock_guard<std::mutex> ul_lock(db->user_list_mutex);
+        auto user_it = users_list.find(passkey);
+        if (user_it == users_list.end()) {
+            stats.auth_error_announce_key++;
+            return "Passkey not found";
+        }
+        u = user_it->second;
+    }
+
+    std::lock_guard<std::mutex> tl_lock(db->torrent_list_mutex);
+    auto tor = torrents_list.find(info_hash);
+    if (tor == torrents_list.end()) {
+        return unregistered_torrent(info_hash);
+    }
+    return announce_peer(tor->second, u, req, ip, result);
+}
+
+// Scrape from the UDP tracker. Unknown torrents get zeros, like the protocol asks
+// Returns an error message, or an empty string on success
+std::string worker::udp_scrape(const std::vector<infohash_t> &info_hashes, std::vector<scrape_result> &results) {
+    // Unlike HTTP scrapes these have no passkey to check
+    if (!udp_scrape_enabled) {
+        return "Scrape is not supported over UDP";
+    }
+    stats.scrapes++;
+    results.resize(info_hashes.size());
+    std::lock_guard<std::mutex> tl_lock(db->torrent_list_mutex);
+    for (size_t i = 0; i < info_hashes.size(); i++) {
+        torrent_list::iterator tor = torrents_list.find(info_hashes[i]);
+        if (tor == torrents_list.end()) {
+            results[i] = scrape_result{0, 0, 0};
+            continue;
+        }
+        results[i].seeders = tor->second.seeders.size();
+        results[i].completed = tor->second.completed;
+        results[i].leechers = tor->second.leechers.size();
+    }
+    return "";
 }
 
 // TODO: Restrict to local IPs
-std::string worker::update(params_type &params, client_opts_t &client_opts) {
+response_t worker::update(params_type &params, client_opts_t &client_opts) {
     std::string action(params["action"]);
+    // Actions on a torrent find it by info_hash. One that doesn't decode to 20
+    // bytes is all zeros, and matches no torrent
+    infohash_t info_hash = {};
+    bool valid_info_hash = false;
+    auto info_hash_it = params.find("info_hash");
+    if (info_hash_it != params.end()) {
+        valid_info_hash = percent_decode(info_hash_it->second, info_hash);
+        if (!valid_info_hash) {
+            info_hash.fill(0);
+        }
+    }
     if (action == "change_passkey") {
         std::string oldpasskey = params["oldpasskey"];
         std::string newpasskey = params["newpasskey"];
+        passkey_t new_key;
         std::lock_guard<std::mutex> ul_lock(db->user_list_mutex);
         auto u = users_list.find(oldpasskey);
         if (u == users_list.end()) {
             logger->warn("No user with passkey " + oldpasskey + " exists when attempting to change passkey to " + newpasskey);
+        } else if (!passkey_from_string(newpasskey, new_key)) {
+            logger->warn("Invalid passkey " + newpasskey + " when attempting to change passkey from " + oldpasskey);
         } else {
-            users_list[newpasskey] = u->second;
-            users_list.erase(oldpasskey);
-            logger->info("Changed passkey from " + oldpasskey + " to " + newpasskey + " for user " + std::to_string(u->second->get_id()));
+            // Inserting may move the users around, so take this one out first
+            user_ptr moved_user = u->second;
+            users_list.erase(u);
+            users_list[new_key] = moved_user;
+            logger->info("Changed passkey from " + oldpasskey + " to " + newpasskey + " for user " + std::to_string(moved_user->get_id()));
         }
     } else if (action == "add_torrent") {
+        if (!valid_info_hash) {
+            logger->warn("Invalid info hash for torrent " + params["id"]);
+            return http_response("success", client_opts);
+        }
         torrent *t;
-        std::string info_hash = params["info_hash"];
-        info_hash = hex_decode(info_hash);
         std::lock_guard<std::mutex> tl_lock(db->torrent_list_mutex);
         auto i = torrents_list.find(info_hash);
         if (i == torrents_list.end()) {
@@ -864,7 +906,7 @@ std::string worker::update(params_type &params, client_opts_t &client_opts) {
             t->id = static_cast<torid_t>(strtoint32(params["id"]));
             t->balance = 0;
             t->completed = 0;
-            t->last_selected_seeder = "";
+            t->next_seeder = 0;
         } else {
             t = &i->second;
         }
@@ -877,8 +919,6 @@ std::string worker::update(params_type &params, client_opts_t &client_opts) {
         }
         logger->info("Added torrent " + std::to_string(t->id) + ". FL: " + std::to_string(t->free_torrent) + " " + params["freetorrent"]);
     } else if (action == "update_torrent") {
-        std::string info_hash = params["info_hash"];
-        info_hash = hex_decode(info_hash);
         freetype fl;
         if (params["freetorrent"] == "0") {
             fl = NORMAL;
@@ -893,7 +933,7 @@ std::string worker::update(params_type &params, client_opts_t &client_opts) {
             torrent_it->second.free_torrent = fl;
             logger->info("Updated torrent " + std::to_string(torrent_it->second.id) + " to FL " + std::to_string(fl));
         } else {
-            logger->warn("Failed to find torrent " + std::string(info_hash) + " to FL " + std::to_string(fl));
+            logger->warn("Failed to find torrent " + bintohex(binary_view(info_hash)) + " to FL " + std::to_string(fl));
         }
     } else if (action == "update_torrents") {
         // Each decoded infohash is exactly 20 characters long.
@@ -908,18 +948,18 @@ std::string worker::update(params_type &params, client_opts_t &client_opts) {
             fl = NEUTRAL;
         }
         std::lock_guard<std::mutex> tl_lock(db->torrent_list_mutex);
-        for (unsigned int pos = 0; pos < info_hashes.length(); pos += 20) {
-            std::string info_hash = info_hashes.substr(pos, 20);
+        const std::string_view all_hashes(info_hashes);
+        for (size_t pos = 0; pos + info_hash.size() <= all_hashes.size(); pos += info_hash.size()) {
+            infohash_from_binary(all_hashes.substr(pos, info_hash.size()), info_hash);
             auto torrent_it = torrents_list.find(info_hash);
             if (torrent_it != torrents_list.end()) {
                 torrent_it->second.free_torrent = fl;
                 logger->info("Updated torrent " + std::to_string(torrent_it->second.id) + " to FL " + std::to_string(fl));
             } else {
-                logger->warn("Failed to find torrent " + info_hash + " to FL " + std::to_string(fl));
+                logger->warn("Failed to find torrent " + bintohex(binary_view(info_hash)) + " to FL " + std::to_string(fl));
             }
         }
     } else if (action == "add_token") {
-        std::string info_hash = hex_decode(params["info_hash"]);
         int userid = atoi(params["userid"].c_str());
         std::lock_guard<std::mutex> tl_lock(db->torrent_list_mutex);
         auto torrent_it = torrents_list.find(info_hash);
@@ -929,18 +969,15 @@ std::string worker::update(params_type &params, client_opts_t &client_opts) {
             logger->warn("Failed to find torrent to add a token for user " + std::to_string(userid));
         }
     } else if (action == "remove_token") {
-        std::string info_hash = hex_decode(params["info_hash"]);
         int userid = atoi(params["userid"].c_str());
         std::lock_guard<std::mutex> tl_lock(db->torrent_list_mutex);
         auto torrent_it = torrents_list.find(info_hash);
         if (torrent_it != torrents_list.end()) {
             torrent_it->second.tokened_users.erase(userid);
         } else {
-            logger->warn("Failed to find torrent " + info_hash + " to remove token for user " + std::to_string(userid));
+            logger->warn("Failed to find torrent " + bintohex(binary_view(info_hash)) + " to remove token for user " + std::to_string(userid));
         }
     } else if (action == "delete_torrent") {
-        std::string info_hash = params["info_hash"];
-        info_hash = hex_decode(info_hash);
         int reason = -1;
         auto reason_it = params.find("reason");
         if (reason_it != params.end()) {
@@ -965,17 +1002,22 @@ std::string worker::update(params_type &params, client_opts_t &client_opts) {
             del_reasons[info_hash] = msg;
             torrents_list.erase(torrent_it);
         } else {
-            logger->warn("Failed to find torrent " + bintohex(info_hash) + " to delete ");
+            logger->warn("Failed to find torrent " + bintohex(binary_view(info_hash)) + " to delete ");
         }
     } else if (action == "add_user") {
         std::string passkey = params["passkey"];
         userid_t userid = strtoint32(params["id"]);
+        passkey_t key;
+        if (!passkey_from_string(passkey, key)) {
+            logger->warn("Invalid passkey " + passkey + " for user " + std::to_string(userid));
+            return http_response("success", client_opts);
+        }
         std::lock_guard<std::mutex> ul_lock(db->user_list_mutex);
-        auto u = users_list.find(passkey);
+        auto u = users_list.find(key);
         if (u == users_list.end()) {
             bool protect_ip = params["visible"] == "0";
             user_ptr tmp_user = std::make_shared<user>(userid, true, protect_ip);
-            users_list.insert(std::pair<std::string, user_ptr>(passkey, tmp_user));
+            users_list.insert(std::pair<passkey_t, user_ptr>(key, tmp_user));
             logger->info("Added user " + passkey + " with id " + std::to_string(userid));
         } else {
             logger->warn("Tried to add already known user " + passkey + " with id " + std::to_string(userid));
@@ -992,15 +1034,15 @@ std::string worker::update(params_type &params, client_opts_t &client_opts) {
         }
     } else if (action == "remove_users") {
         // Each passkey is exactly 32 characters long.
-        std::string passkeys = params["passkeys"];
+        const std::string &passkeys = params["passkeys"];
         std::lock_guard<std::mutex> ul_lock(db->user_list_mutex);
-        for (unsigned int pos = 0; pos < passkeys.length(); pos += 32) {
-            std::string passkey = passkeys.substr(pos, 32);
+        for (size_t pos = 0; pos + PASSKEY_LENGTH <= passkeys.length(); pos += PASSKEY_LENGTH) {
+            std::string_view passkey = std::string_view(passkeys).substr(pos, PASSKEY_LENGTH);
             auto u = users_list.find(passkey);
             if (u != users_list.end()) {
-                logger->info("Removed user " + passkey);
+                logger->info("Removed user " + std::string(passkey));
                 u->second->set_deleted(true);
-                users_list.erase(passkey);
+                users_list.erase(u);
             }
         }
     } else if (action == "update_user") {
@@ -1062,7 +1104,6 @@ std::string worker::update(params_type &params, client_opts_t &client_opts) {
     } else if (action == "info_torrent") {
         std::stringstream output;
         std::string info_hash_hex = params["info_hash"];
-        std::string info_hash = hex_decode(info_hash_hex);
         std::lock_guard<std::mutex> tl_lock(db->torrent_list_mutex);
         auto torrent_it = torrents_list.find(info_hash);
         output << "{\"hash\":" << std::string(info_hash_hex);
@@ -1078,10 +1119,9 @@ std::string worker::update(params_type &params, client_opts_t &client_opts) {
     return http_response("success", client_opts);
 }
 
-peer_list::iterator worker::add_peer(peer_list &peer_list, const std::string &peer_key) {
+size_t worker::add_peer(peer_list &peer_list, const peer_key_t &peer_key) {
     peer new_peer;
-    auto it = peer_list.insert(std::pair<std::string, peer>(peer_key, new_peer));
-    return it.first;
+    return peer_list.insert(peer_key, new_peer).first;
 }
 
 void worker::start_reaper() {
@@ -1101,49 +1141,68 @@ void worker::do_start_reaper() {
 void worker::reap_peers() {
     logger->info("Starting peer reaper");
     cur_time = time(NULL);
+    const uint32_t now = peer_time(cur_time);
+    uint64_t peer_list_bytes = 0;
+    uint64_t peers = 0;
     unsigned int reaped_l = 0, reaped_s = 0;
     unsigned int cleared_torrents = 0;
-    for (auto t = torrents_list.begin(); t != torrents_list.end(); ++t) {
+    // The peer lists move their peers around when they change, so each torrent is
+    // reaped with the list locked. Announces get a turn between torrents
+    std::unique_lock<std::mutex> tl_lock(db->torrent_list_mutex);
+    size_t generation = torrents_list.generation();
+    auto t = torrents_list.begin();
+    while (t != torrents_list.end()) {
         bool reaped_this = false;  // True if at least one peer was deleted from the current torrent
-        auto p = t->second.leechers.begin();
-        peer_list::iterator del_p;
-        while (p != t->second.leechers.end()) {
-            if (p->second.last_announced + peers_timeout < cur_time) {
-                std::lock_guard<std::mutex> tl_lock(db->torrent_list_mutex);
-                del_p = p++;
-                del_p->second.user->decr_leeching();
-                t->second.leechers.erase(del_p);
+        peer_list &leechers = t->second.leechers;
+        for (size_t i = 0; i < leechers.size(); ) {
+            if (leechers.at(i).last_announced + peers_timeout < now) {
+                leechers.at(i).user->decr_leeching();
+                leechers.erase(i);  // The last leecher takes its place
                 reaped_this = true;
                 reaped_l++;
             } else {
-                ++p;
+                i++;
             }
         }
-        p = t->second.seeders.begin();
-        while (p != t->second.seeders.end()) {
-            if (p->second.last_announced + peers_timeout < cur_time) {
-                std::lock_guard<std::mutex> tl_lock(db->torrent_list_mutex);
-                del_p = p++;
-                del_p->second.user->decr_seeding();
-                t->second.seeders.erase(del_p);
+        peer_list &seeders = t->second.seeders;
+        for (size_t i = 0; i < seeders.size(); ) {
+            if (seeders.at(i).last_announced + peers_timeout < now) {
+                seeders.at(i).user->decr_seeding();
+                seeders.erase(i);
                 reaped_this = true;
                 reaped_s++;
             } else {
-                ++p;
+                i++;
             }
         }
         if (reaped_this && t->second.seeders.empty() && t->second.leechers.empty()) {
-            std::stringstream record;
+            record_buffer record;
             record << '(' << t->second.id << ",0,0,0," << t->second.balance << ')';
-            std::string record_str = record.str();
-            db->record_torrent(record_str);
+            db->record_torrent(record.view());
             cleared_torrents++;
         }
+        peer_list_bytes += leechers.memory_usage() + seeders.memory_usage();
+        peers += leechers.size() + seeders.size();
+        tl_lock.unlock();
+        tl_lock.lock();
+        if (torrents_list.generation() != generation) {
+            // A torrent was added and the list moved everything while it was unlocked.
+            // Peers that were reaped are gone, so going over it again only redoes the counting
+            generation = torrents_list.generation();
+            peer_list_bytes = 0;
+            peers = 0;
+            t = torrents_list.begin();
+        } else {
+            ++t;
+        }
     }
+    tl_lock.unlock();
     if (reaped_l || reaped_s) {
         stats.leechers -= reaped_l;
         stats.seeders -= reaped_s;
     }
+    stats.peer_list_bytes = peer_list_bytes;
+    stats.bytes_per_peer = peers == 0 ? 0 : peer_list_bytes / peers;
     logger->info("Reaped " + std::to_string(reaped_l) + " leechers and " + std::to_string(reaped_s)
                  + " seeders. Reset " + std::to_string(cleared_torrents) + " torrents");
 }
@@ -1246,5 +1305,5 @@ std::string worker::get_del_reason(int code) {
 /* Peers should be invisible if they are a leecher without
    download privs or their IP is invalid */
 bool worker::peer_is_visible(user_ptr &u, peer *p) {
-    return (p->left == 0 || u->can_leech()) && !p->invalid_ip;
+    return (p->seeding || u->can_leech()) && !p->invalid_ip;
 }
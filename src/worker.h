@@ -6,6 +6,7 @@
 #include <spdlog/spdlog.h>
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <list>
 #include <unordered_map>
@@ -16,9 +17,57 @@
 #include <random>
 
 #include "site_comm.h"
+#include "response.h"
+#include "request.h"
 
 enum tracker_status { OPEN, PAUSED, CLOSING };  // tracker status
 
+enum announce_event { EVENT_NONE, EVENT_COMPLETED, EVENT_STARTED, EVENT_STOPPED };
+
+// An announce decoded from an HTTP query string or a UDP tracker packet
+struct announce_request {
+    peerid_t peer_id;
+    int64_t left;
+    int64_t uploaded;
+    int64_t downloaded;
+    int64_t corrupt;
+    announce_event event;
+    uint16_t port;
+    int32_t numwant;  // negative if the client didn't ask for a number of peers
+    std::string_view user_agent;  // points into the request, empty for UDP
+};
+
+// The query of an HTTP announce, decoded in one pass over its parameters
+struct http_announce {
+    announce_request req;
+    infohash_t info_hash;
+    bool compact;
+    bool has_info_hash;  // present and valid
+    bool has_peer_id;
+    bool valid_peer_id;
+    bool has_ip;
+    bool has_ipv4;
+    std::string_view ip;
+    std::string_view ipv4;
+};
+
+// The swarm as the announcing peer gets to see it
+struct announce_result {
+    std::string peers;  // compact
+    std::string peers6;  // compact, IPv6 peers
+    size_t seeders;
+    size_t leechers;
+    uint32_t completed;
+    unsigned int interval;
+    bool invalid_ip;
+};
+
+struct scrape_result {
+    uint32_t seeders;
+    uint32_t completed;
+    uint32_t leechers;
+};
+
 class worker {
  private:
     config * conf;
@@ -27,7 +76,7 @@ class worker {
     torrent_list &torrents_list;
     user_list &users_list;
     std::vector<std::string> &whitelist;
-    std::unordered_map<std::string, del_message> del_reasons;
+    std::unordered_map<infohash_t, del_message, infohash_hasher> del_reasons;
     tracker_status status;
     bool reaper_active;
     time_t cur_time;
@@ -41,6 +90,7 @@ class worker {
     unsigned int peers_timeout;
     unsigned int numwant_limit;
     bool keepalive_enabled;
+    bool udp_scrape_enabled;
     std::string site_password;
     std::string report_password;
 
@@ -50,16 +100,20 @@ class worker {
     void reap_peers();
     void reap_del_reasons();
     std::string get_del_reason(int code);
-    peer_list::iterator add_peer(peer_list &peer_list, const std::string &peer_id);
+    std::string unregistered_torrent(const infohash_t &info_hash);
+    std::string announce_peer(torrent &tor, user_ptr &u, const announce_request &req, const ip_address &ip, announce_result &result);
+    size_t add_peer(peer_list &peer_list, const peer_key_t &peer_key);
     inline bool peer_is_visible(user_ptr &u, peer *p);
 
  public:
     worker(config * conf_obj, torrent_list &torrents, user_list &users, std::vector<std::string> &_whitelist, mysql * db_obj, site_comm * sc);
     void reload_config(config * conf);
-    std::string work(const std::string &input, std::string &ip, client_opts_t &client_opts);
-    std::string announce(const std::string &input, torrent &tor, user_ptr &u, params_type &params, params_type &headers, std::string &ip, client_opts_t &client_opts);
-    std::string scrape(const std::list<std::string> &infohashes, params_type &headers, client_opts_t &client_opts);
-    std::string update(params_type &params, client_opts_t &client_opts);
+    response_t work(const request_t &req, request_status req_status, ip_address &ip, client_opts_t &client_opts);
+    response_t announce(const http_announce &params, const request_t &http_req, torrent &tor, user_ptr &u, ip_address &ip, client_opts_t &client_opts);
+    response_t scrape(const request_t &params, client_opts_t &client_opts);
+    response_t update(params_type &params, client_opts_t &client_opts);
+    std::string udp_announce(const std::string &passkey, const infohash_t &info_hash, const announce_request &req, const ip_address &ip, announce_result &result);
+    std::string udp_scrape(const std::vector<infohash_t> &info_hashes, std::vector<scrape_result> &results);
 
     void reload_lists();
     bool shutdown();